@@ -1,7 +1,24 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <mutex>
 #include <vector>
+#include "coding_options.h"
+#include "inference_options.h"
+
+class OnnxModelInferenceWrapper;
+class EntropyBottleNeck;
+class ThreadPool;
+
+// 一个执行后端上 g_a / g_s 的耗时
+struct ProviderBenchmark {
+    ExecutionProvider requested;
+    ExecutionProvider used;  // requested 不可用时为 Cpu
+    double load_ms;          // 创建 g_a 和 g_s 的 session
+    double g_a_ms;           // repeat 次中最快的一次
+    double g_s_ms;
+    double max_abs_diff;     // g_s 输出与第一个后端的最大差
+};
 
 struct Params {
     char quality;
@@ -13,11 +30,174 @@ struct Params {
     std::string metric_name;
     std::shared_ptr<uint8_t> rgb_data;
     std::string compressed_string;
+    CodingOptions coding = CodingOptions();
+    // 全部子码流 (coding.n_substreams 个), compressed_string 为其中第一个
+    // 解码时为空则只使用 compressed_string
+    std::vector<std::string> compressed_strings;
+    // g_a 输入上方和左侧的填充, encode 写入, coding.minimal_padding 时 decode 按此裁剪
+    uint32_t pad_top = 0;
+    uint32_t pad_left = 0;
+};
+
+
+// g_a 输入在一个方向上填充后的尺寸: 默认补到 64 的倍数、两侧各补一半 (与 CompressAI 相同),
+// minimal_padding 时补到 16 的倍数, 前面补一半, 多出的一个像素补在后面
+// g_a / g_s 是全卷积网络, 计算量与填充后的面积成正比
+uint32_t padded_size(uint32_t size, bool minimal_padding = false);
+
+
+// 解码输出的通道顺序, Bgr 可以直接交给 OpenCV
+enum class ChannelOrder : uint8_t {
+    Rgb = 0,
+    Bgr = 1,
+};
+
+
+// 编码输入的 8 位三通道图像, 只引用调用方的内存, 预处理直接从中读取, 编码前不做任何拷贝
+// 可以直接描述 cv::Mat (data, cols, rows, step, Bgr), 调用方保证 encode 返回前内存有效
+struct ImageView {
+    const uint8_t* data = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    size_t stride = 0;  // 每行的字节数, 0 为紧密排列的 width * 3
+    ChannelOrder order = ChannelOrder::Rgb;
+    // 只编码 [roi_x, roi_x + roi_width) x [roi_y, roi_y + roi_height), roi_width 或 roi_height 为 0 时为整张图像
+    uint32_t roi_x = 0;
+    uint32_t roi_y = 0;
+    uint32_t roi_width = 0;
+    uint32_t roi_height = 0;
+};
+
+
+// Codec::encode 分成的三个阶段之间传递的数据, 流水线编码 (pipeline_encoder.h) 中每张图像一份
+struct EncodeStage {
+    // 填充 (见 padded_size), 填充后的尺寸和潜变量的尺寸
+    uint32_t pad_top = 0;
+    uint32_t pad_left = 0;
+    uint32_t padded_height = 0;
+    uint32_t padded_width = 0;
+    uint32_t rows = 0;
+    uint32_t cols = 0;
+    std::vector<float> input;  // 归一化后的 [3, padded_height, padded_width], 分块推理时为空
+    std::vector<float> y;      // g_a 的输出 [C, rows, cols]
+    // 已应用 ROI 的输入图像, 分块推理时 g_a 阶段仍从中读取
+    ImageView image;
 };
 
 
+// 常驻的编解码引擎, 模型只加载一次, 之后的 encode / decode 复用同一组 session 和熵模型
+// 熵模型在构造时加载, g_a / g_s 在第一次 encode / decode 时才加载 (只解码时不加载 g_a)
+// encode / decode 可在多个线程中同时调用
+class Codec {
+    public:
+        // quality 为 '3' 或 3 均可
+        Codec(const std::string& model_dir, const std::string& model_name = "bmshj2018-factorized",
+              const std::string& metric_name = "mse", char quality = '3',
+              const InferenceOptions& inference = InferenceOptions());
+        ~Codec();
+
+        Codec(const Codec&) = delete;
+        Codec& operator=(const Codec&) = delete;
+
+        // 与 encode_buffer / decode_buffer 相同, params 的模型必须与 Codec 一致
+        void encode(Params& params);
+        // 直接编码 image (的 ROI), params.original_width / original_height 设为 ROI 的尺寸, 不使用 params.rgb_data
+        void encode(Params& params, const ImageView& image);
+        // 输出写入新分配的 params.rgb_data, 为 order 顺序的 HWC 8 位图像
+        void decode(Params& params, ChannelOrder order = ChannelOrder::Rgb);
+        // 只解码原图中 [x, x + width) x [y, y + height) 的区域, 输出 height x width 的图像写入 params.rgb_data
+        // 区域向外扩展 InferenceOptions::tile_overlap 作为 g_s 感受野的余量, 只熵解码与之相交的块 (CodingOptions::spatial_tile),
+        // g_s 也只在这个范围上推理, 耗时与区域大小相关而与图像大小无关; 码流必须是分块编码的, 否则抛出异常
+        void decode_region(Params& params, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                           ChannelOrder order = ChannelOrder::Rgb);
+        // encode 的三个阶段, encode 等于依次调用这三个函数, 流水线编码在不同线程中分别调用
+        // 预处理: 检查 params 和 image, 计算填充, 把图像写成 g_a 的输入
+        // params.original_width / original_height 必须等于 image 的 ROI 尺寸, 分块推理时 image 要保持到 encode_analysis 之后
+        void encode_prepare(const Params& params, const ImageView& image, EncodeStage& stage);
+        // g_a 推理, 写入 stage.y
+        void encode_analysis(const Params& params, EncodeStage& stage);
+        // 熵编码, 写入 params 的码流和潜变量尺寸
+        void encode_entropy(Params& params, const EncodeStage& stage);
+        // 批量编解码: 填充后尺寸相同的图像合并成 N > 1 的一次 g_a / g_s 推理, 结果按图像写回各自的 params
+        // 模型的 batch 维不是动态的, 或者需要分块推理时, 逐张处理
+        void encode_batch(std::vector<Params>& batch);
+        void decode_batch(std::vector<Params>& batch);
+        // 加载 g_a / g_s 并按 InferenceOptions::warmup_shapes 各推理一次, warmup_shapes 非空时构造函数会调用
+        void warmup();
+        // 在每个后端上用 image_path 的同一组输入运行 g_a / g_s, 第一次用于预热, 之后计时 repeat 次
+        // 只使用本 Codec 的模型和精度, 不影响 encode / decode 使用的 session
+        std::vector<ProviderBenchmark> benchmark_providers(const std::string& image_path,
+                                                           const std::vector<ExecutionProvider>& providers,
+                                                           int repeat = 3);
+
+        const std::string& model_name() const { return model_name_; }
+        const std::string& metric_name() const { return metric_name_; }
+        char quality() const { return quality_; }
+
+    private:
+        std::string model_path(const std::string& suffix) const;
+        // g_a / g_s 按 InferenceOptions::precision 选择的 onnx 文件
+        std::string network_path(const std::string& network) const;
+        void check_params(const Params& params) const;
+
+        // 图像 (填充后) 大于一块时才分块
+        bool use_tiles(uint32_t height, uint32_t width) const;
+        // 分块推理, y 为整个潜变量 [C, rows, cols], rgb 为裁剪后的 HWC 图像
+        void run_g_a_tiled(const ImageView& image, uint32_t pad_top, uint32_t pad_left, uint32_t rows, uint32_t cols,
+                           float* y);
+        // (top, left) 为原图在 g_s 输出中的左上角
+        void run_g_s_tiled(const float* y, uint32_t rows, uint32_t cols, uint32_t top, uint32_t left,
+                           uint32_t original_height, uint32_t original_width, uint8_t* rgb, bool bgr);
+
+        OnnxModelInferenceWrapper& g_a();
+        OnnxModelInferenceWrapper& g_s();
+        // 图像前后处理按行并行用的线程池, 即 shared_thread_pool()
+        ThreadPool& thread_pool();
+
+        std::string model_dir_;
+        std::string model_name_;
+        std::string metric_name_;
+        char quality_;
+        InferenceOptions inference_;
+
+        std::unique_ptr<EntropyBottleNeck> entropy_bottleneck_;
+        std::once_flag g_a_once_;
+        std::unique_ptr<OnnxModelInferenceWrapper> g_a_;
+        std::once_flag g_s_once_;
+        std::unique_ptr<OnnxModelInferenceWrapper> g_s_;
+};
+
+
+// 以下函数每次调用都会创建并丢弃一个 Codec, 需要多次编解码时请直接使用 Codec
 void encode_buffer(Params& params, const std::string& model_dir);
-void encode_file(const std::string& input_file, const std::string& output_file, Params& params, const std::string& model_dir);
+void encode_buffer(Params& params, const ImageView& image, const std::string& model_dir);
+void encode_file(const std::string& input_file, const std::string& output_file, Params& params, const std::string& model_dir,
+                 const InferenceOptions& inference = InferenceOptions());
 void decode_buffer(Params& params, const std::string& model_dir);
-void decode_file(const std::string& compressed_file, const std::string& output_image_path, const std::string& model_dir);
-void read_compressed_info(const std::string& compressed_file);
\ No newline at end of file
+void decode_file(const std::string& compressed_file, const std::string& output_image_path, const std::string& model_dir,
+                 const InferenceOptions& inference = InferenceOptions());
+void encode_file(const std::string& input_file, const std::string& output_file, Params& params, Codec& codec);
+// 把 encode 之后的 params 写成 .cmpai 文件
+void save_compressed(const Params& params, const std::string& output_file);
+void decode_file(const std::string& compressed_file, const std::string& output_image_path, Codec& codec);
+// 只解码并保存原图中 [x, x + width) x [y, y + height) 的区域, 见 Codec::decode_region
+void decode_file_region(const std::string& compressed_file, const std::string& output_image_path, uint32_t x,
+                        uint32_t y, uint32_t width, uint32_t height, const std::string& model_dir,
+                        const InferenceOptions& inference = InferenceOptions());
+void decode_file_region(const std::string& compressed_file, const std::string& output_image_path, uint32_t x,
+                        uint32_t y, uint32_t width, uint32_t height, Codec& codec);
+void read_compressed_info(const std::string& compressed_file);
+
+// 一张图像的编解码结果, 用于比较不同精度 / 选项的质量和速度
+struct EvalResult {
+    double psnr;       // RGB8 重建相对原图, dB
+    double bpp;        // 全部子码流的字节数 * 8 / 像素数
+    double encode_ms;  // repeat 次中最快的一次
+    double decode_ms;
+    uint32_t height;   // 原图尺寸
+    uint32_t width;
+};
+
+// 编码再解码 image_path, 第一次用于加载和预热, 之后计时 repeat 次
+EvalResult evaluate_file(const std::string& image_path, Codec& codec, const CodingOptions& coding = CodingOptions(),
+                         int repeat = 3);
\ No newline at end of file
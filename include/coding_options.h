@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+
+// 熵编码器
+enum class EntropyCoder : uint8_t {
+    Rans64 = 0,    // rans64.h, CompressAI 兼容
+    RansSimd = 1,  // rans_word_sse41.h, 8 路 SIMD 解码, 码流与 CompressAI 不兼容
+};
+
+// 码流编码选项
+// 默认值对应 CompressAI 兼容的码流, 任何非默认选项都会在 .cmpai 文件头中写入扩展字段
+struct CodingOptions {
+    // rANS 交错状态数: 1 (CompressAI 兼容), 2, 4, 8
+    uint8_t rans_interleave = 1;
+    // 熵编码器, RansSimd 时 rans_interleave 不起作用
+    EntropyCoder entropy_coder = EntropyCoder::Rans64;
+    // 按通道分组的独立子码流数, 写入 n_strings, 编解码时每个子码流一个线程
+    uint8_t n_substreams = 1;
+    // 分块编码时每块的 rANS 符号数上限, 限制编码器的内存峰值; 0 为不分块
+    // RansSimd 时不起作用
+    uint32_t rans_chunk_symbols = 0;
+    // 每个子码流以通道标志位图开头, 常数通道只写入其取值, 不做 rANS 编码
+    bool skip_constant_channels = false;
+    // g_a 的输入只补到 16 (g_a 的下采样倍数) 的倍数, 而不是 CompressAI 的 64, 实际的填充写入文件头
+    // 每边最多少算 48 个像素, 接近 64 的倍数多一点的尺寸 g_a / g_s 的计算量接近减半
+    bool minimal_padding = false;
+    // 潜变量按 spatial_tile x spatial_tile (潜变量的行列数, 对应 16 倍的像素) 分块, 每块单独编码 n_substreams 个子码流,
+    // 码流按 [块 (行优先)][子码流] 排列, 文件中每个子码流的长度即为块索引, 局部解码 (Codec::decode_region) 只解码相交的块
+    // 0 为不分块
+    uint16_t spatial_tile = 0;
+
+    bool compressai_compatible() const {
+        return rans_interleave == 1 && entropy_coder == EntropyCoder::Rans64 && n_substreams == 1 &&
+               rans_chunk_symbols == 0 && !skip_constant_channels && !minimal_padding && spatial_tile == 0;
+    }
+};
@@ -1,26 +1,64 @@
 #include <onnxruntime_cxx_api.h>
 #include <cnpy.h>
 #include "rans_interface.hpp"
+#include "rans_simd.hpp"
+#include "coding_options.h"
+#include "thread_pool.h"
 #include <xtensor/containers/xarray.hpp>
 #include <xtensor/io/xio.hpp>
 #include <xtensor/views/xview.hpp>
 #include <xtensor/io/xnpy.hpp>
 #include <variant>
+#include <memory>
+#include <mutex>
 
 class EntropyBottleNeck {
     public:
         EntropyBottleNeck(const std::string& npz_path);
         ~EntropyBottleNeck();
 
-        std::vector<std::string> compress(const xt::xarray<float>& input);
-        xt::xarray<float> decompress(const std::vector<std::string>& strings_list, const std::vector<int>& input_shape);
+        std::vector<std::string> compress(const xt::xarray<float>& input, const CodingOptions& coding = CodingOptions());
+        // input 为连续的 NCHW 数据, input_shape 为 {N, C, H, W}, 例如 g_a 直接写出的输出缓冲
+        std::vector<std::string> compress(const float* input, const std::vector<int>& input_shape,
+                                          const CodingOptions& coding = CodingOptions());
+        xt::xarray<float> decompress(const std::vector<std::string>& strings_list, const std::vector<int>& input_shape,
+                                     const CodingOptions& coding = CodingOptions());
+        // 解码并反量化到调用方提供的 NCHW 缓冲 (N * C * H * W 个 float), 可直接作为 g_s 的输入
+        void decompress(const std::vector<std::string>& strings_list, const std::vector<int>& input_shape,
+                        float* output, const CodingOptions& coding = CodingOptions());
+        // 只解码一张图像潜变量 (input_shape 为 {H, W}) 中 [row_begin, row_end) x [col_begin, col_end) 的窗口,
+        // 写入 [C, row_end - row_begin, col_end - col_begin] 的 output
+        // 只解码与窗口相交的块, 码流必须是 coding.spatial_tile > 0 编码的, 否则抛出异常
+        void decompress_region(const std::vector<std::string>& strings_list, const std::vector<int>& input_shape,
+                               int row_begin, int row_end, int col_begin, int col_end, float* output,
+                               const CodingOptions& coding = CodingOptions());
+        // 潜变量的通道数 C
+        int channels() const { return static_cast<int>(cdf_table_.size()); }
 
         RansEncoder rans_enc = RansEncoder();
         RansDecoder rans_dec = RansDecoder();
     
     private:
-        std::vector<std::vector<int>> quantized_cdf_;
-        std::vector<int> cdf_length_;
-        std::vector<int> offset_;
-        std::vector<float> quantiles_;
+        std::vector<float> medians_;
+        RansCdfTable cdf_table_;
+
+        // 单个子码流的编解码, 可在多个线程中同时调用
+        // symbols 为 n_channels 个连续的通道, 每个通道 plane 个符号
+        std::string encode_substream(const int32_t* symbols, int first_channel, int n_channels, size_t plane,
+                                     const CodingOptions& coding);
+        // output 为这些通道的反量化结果
+        void decode_substream(const std::string& encoded, int first_channel, int n_channels, size_t plane,
+                              float* output, const CodingOptions& coding);
+        // coding.spatial_tile > 0 时解码一张图像 (strings 为它的 n_tiles * K 个子码流) 中与窗口相交的块,
+        // 写入 [C, row_end - row_begin, col_end - col_begin] 的 output
+        void decode_tiles(const std::string* strings, int H, int W, int row_begin, int row_end, int col_begin,
+                          int col_end, float* output, const CodingOptions& coding);
+
+        // 子码流编解码用的线程池, 即 shared_thread_pool(), 与 Codec 的前后处理共用
+        ThreadPool& thread_pool();
+
+        // SIMD 编码器的 12 位查找表约 20KB/通道, 第一次使用时才构建
+        const RansSimdTable& simd_table();
+        std::once_flag simd_table_once_;
+        std::unique_ptr<RansSimdTable> simd_table_;
 };
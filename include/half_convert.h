@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "inference_options.h"
+
+// float32 与 16 位浮点 (IEEE fp16 / bfloat16) 之间的转换, 用于 FP16 / BF16 模型的输入输出
+// 有 F16C / AVX2 时向量化, 否则逐个转换, 舍入方式均为就近偶数
+void float_to_fp16(const float* src, uint16_t* dst, size_t n);
+void fp16_to_float(const uint16_t* src, float* dst, size_t n);
+void float_to_bf16(const float* src, uint16_t* dst, size_t n);
+void bf16_to_float(const uint16_t* src, float* dst, size_t n);
+
+// 当前 CPU 是否有该精度的原生计算指令: Fp16 需要 AVX512-FP16, Bf16 需要 AVX512-BF16 或 AMX-BF16
+// (同时检查操作系统是否保存对应的寄存器状态). Fp32 / Int8 总是返回 true
+bool cpu_supports_precision(ModelPrecision precision);
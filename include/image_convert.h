@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "thread_pool.h"
+
+// 交错 RGB8 图像与 g_a / g_s 的平面 float 数据之间的转换, 有 AVX2 时向量化
+// pool 不为 nullptr 时按行分块并行, 行数很少时在调用线程执行
+
+// 把 height x width 的 HWC RGB8 图像中填充后坐标 [y0, y0 + th) x [x0, x0 + tw) 的区域写成归一化的 [3, th, tw]
+// 图像每行 stride 字节 (可以大于 width * 3), bgr 时输入为 BGR8, 输出仍为 RGB 平面
+// 图像在填充后的位置为 (pad_top, pad_left), 图像之外为 0, 值为 v / 255
+void rgb8_to_planar(const uint8_t* rgb, size_t stride, bool bgr, uint32_t height, uint32_t width, uint32_t pad_top,
+                    uint32_t pad_left, uint32_t y0, uint32_t x0, uint32_t th, uint32_t tw, float* out,
+                    ThreadPool* pool = nullptr);
+
+// 把 [3, plane_h, plane_w] 的 RGB 平面 (g_s 的输出) 中 [y0, y1) x [x0, x1) 的区域写成交错的 RGB8, bgr 时为 BGR8
+// clamp(0, 1) * 255 后截断, 与 CompressAI / torchvision 的 ToPILImage 相同
+// dst 指向区域左上角, dst_stride 为 dst 每行的字节数
+void planar_to_rgb8(const float* chw, size_t plane_h, size_t plane_w, uint32_t y0, uint32_t y1, uint32_t x0,
+                    uint32_t x1, uint8_t* dst, size_t dst_stride, bool bgr = false, ThreadPool* pool = nullptr);
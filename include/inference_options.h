@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// g_a / g_s 模型的精度, 每种精度对应一组 onnx 文件, 熵模型相同, 码流可以互相解码
+enum class ModelPrecision : uint8_t {
+    Fp32 = 0,  // <model>-g_a.onnx
+    Int8 = 1,  // <model>-g_a.int8.onnx, 由 tools/quantize_int8.py 静态量化生成
+    // 16 位浮点模型, 输入输出在 run 中与 float32 转换, CPU 没有原生指令时退回 Fp32
+    Fp16 = 2,  // <model>-g_a.fp16.onnx, 需要 AVX512-FP16
+    Bf16 = 3,  // <model>-g_a.bf16.onnx, 需要 AVX512-BF16 或 AMX-BF16
+};
+
+// g_a / g_s 使用的 ORT 执行后端, 当前 ORT 库没有编译该后端时退回默认 CPU
+enum class ExecutionProvider : uint8_t {
+    Cpu = 0,       // ORT 默认的 CPU 后端 (MLAS)
+    OpenVino = 1,  // OpenVINO, CPU_FP32
+    Xnnpack = 2,
+    Dnnl = 3,      // oneDNN
+};
+
+// "cpu", "openvino", "xnnpack", "dnnl"
+const char* execution_provider_name(ExecutionProvider provider);
+// 名字无效时返回 false
+bool parse_execution_provider(const std::string& name, ExecutionProvider& provider);
+
+// g_a / g_s 推理选项, 只影响速度和内存, 不写入码流
+struct InferenceOptions {
+    // 非 FP32 精度会改变重建结果, 用 cmpai-cli eval 检查 PSNR / bpp 的变化
+    ModelPrecision precision = ModelPrecision::Fp32;
+    // 不同后端的结果只有浮点舍入上的差别, 用 cmpai-cli bench 比较各后端在本机上的速度
+    ExecutionProvider provider = ExecutionProvider::Cpu;
+
+    // 分块推理的块大小 (像素, 16 的倍数), 0 为整图推理
+    // 分块时 g_a / g_s 的内存峰值只与块大小有关, 与图像大小无关
+    uint32_t tile_size = 0;
+    // 每块四周额外计算的重叠区域 (像素, 16 的倍数), 结果只保留块内部, 拼接处直接裁剪
+    // 不小于网络的感受野 (约 64 像素) 时与整图推理的结果只有浮点舍入上的差别
+    uint32_t tile_overlap = 64;
+    // encode_batch / decode_batch 中一次推理的最大图像数
+    uint32_t max_batch = 8;
+
+    // 优化后模型的缓存目录, 为空时不缓存, 只用于 Cpu 后端
+    // 第一次加载时把 ORT_ENABLE_ALL 优化后的图写入缓存, 之后直接加载, 跳过图优化
+    // 缓存文件按模型内容的哈希和 ORT 版本命名, 其中可能有与 CPU 相关的算子, 不要在不同机器间共享
+    std::string optimized_model_cache_dir;
+    // 预热的填充后图像尺寸 {height, width}, 构造 Codec 时用全 0 输入各推理一次 g_a 和 g_s
+    // 第一次遇到新尺寸的 Run 要规划内存, 比稳定状态慢很多
+    std::vector<std::pair<uint32_t, uint32_t>> warmup_shapes;
+};
+
+
+// 进程内所有 ORT session (g_a, g_s, 多个 Codec) 共享的全局线程池
+struct OrtThreadOptions {
+    // 0 为 ORT 的默认值 (物理核数)
+    uint32_t intra_op_threads = 0;
+    uint32_t inter_op_threads = 0;
+    // 线程空闲时自旋等待, 延迟更低但空闲时占用 CPU
+    bool allow_spinning = true;
+    // intra-op 线程的 CPU 亲和性, ORT 格式: 每个线程一组 ';' 分隔, 组内为 ',' 分隔的核号或 "a-b" 范围
+    // 共 intra_op_threads - 1 组 (调用线程不绑定), 为空不绑定
+    std::string intra_op_affinity;
+};
+
+// 在创建第一个 ORT session 或使用 shared_thread_pool 之前调用, 之后调用会抛出异常
+void set_ort_thread_options(const OrtThreadOptions& options);
+// 生效的设置: set_ort_thread_options 设置的值, 否则读取环境变量
+// AICODEC_ORT_INTRA_THREADS, AICODEC_ORT_INTER_THREADS, AICODEC_ORT_SPINNING (0 / 1), AICODEC_ORT_AFFINITY
+OrtThreadOptions ort_thread_options();
+
+// 进程内共享的线程池, 用于图像前后处理和熵编解码, 第一次使用时创建
+// 与 ORT 的 intra-op 线程池使用同一个线程数 (intra_op_threads, 0 为全部核), 调用线程也参与执行, 所以工作线程少一个
+ThreadPool& shared_thread_pool();
@@ -3,16 +3,19 @@
 #include <onnxruntime_cxx_api.h>
 #include <cpu_provider_factory.h>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <xtensor/containers/xarray.hpp>
 #include <xtensor/io/xio.hpp>
 #include <xtensor/views/xview.hpp>
 #include <xtensor/io/xnpy.hpp>
 #include <xtensor/misc/xpad.hpp>
+#include "inference_options.h"
 
 template <typename T>
 T vectorProduct(const std::vector<T>& v)
 {
-    return accumulate(v.begin(), v.end(), 1, std::multiplies<T>());
+    return accumulate(v.begin(), v.end(), static_cast<T>(1), std::multiplies<T>());
 }
 
 template <typename T>
@@ -29,23 +32,53 @@ std::ostream& operator<<(std::ostream& os, const std::vector<T>& vec) {
 
 class OnnxModelInferenceWrapper {
     public:
-        OnnxModelInferenceWrapper(const std::string& onnx_path, bool useOPENVINO);
+        // 使用 options.provider 指定的执行后端, 不可用时退回 Cpu, 实际使用的后端见 provider()
+        explicit OnnxModelInferenceWrapper(const std::string& onnx_path,
+                                           const InferenceOptions& options = InferenceOptions());
         ~OnnxModelInferenceWrapper();
 
         std::vector<std::vector<float>> run(const xt::xarray<float>& input, const std::vector<int64_t>& inputDims, const std::vector<int64_t>& outputDims);
+        // input 为连续的 inputDims 形状数据, 直接作为输入 tensor 使用, 不做拷贝
+        std::vector<std::vector<float>> run(const float* input, const std::vector<int64_t>& inputDims, const std::vector<int64_t>& outputDims);
+        // 输入输出都是调用方预先分配的连续缓冲, 通过 Ort::IoBinding 绑定
+        // 推理结果直接写入 output, 重复调用不分配也不拷贝 tensor 数据, 可在多个线程中同时调用
+        // 指针和形状与上一次相同时复用已有的绑定
+        void run(const float* input, const std::vector<int64_t>& inputDims, float* output, const std::vector<int64_t>& outputDims);
+
+        ExecutionProvider provider() const { return provider_; }
 
         std::vector<int64_t> inputDims_;
         std::vector<int64_t> outputDims_;
         
     private:
-        Ort::Env env_;
+        // 一组输入输出绑定和它绑定的缓冲, 指针或形状变化时才重新绑定
+        struct BoundIo {
+            explicit BoundIo(Ort::Session& session) : binding(session) {}
+
+            Ort::IoBinding binding;
+            Ort::Value inputTensor{nullptr};
+            Ort::Value outputTensor{nullptr};
+            const void* inputData = nullptr;
+            std::vector<int64_t> inputDims;
+            void* outputData = nullptr;
+            std::vector<int64_t> outputDims;
+        };
+
+        // 进程内共享, 带全局线程池
+        Ort::Env& env_;
         Ort::SessionOptions sessionOptions_;
         Ort::Session session_;
         Ort::AllocatorWithDefaultOptions allocator_;
+        Ort::MemoryInfo memoryInfo_;
         size_t numInputNodes_;
         size_t numOutputNodes_;
         std::string inputName_;
         std::string outputName_;
         ONNXTensorElementDataType inputType_;
         ONNXTensorElementDataType outputType_;
+        ExecutionProvider provider_;
+
+        // 空闲的绑定, run 取出一个使用后放回, 同时运行的线程各用一个
+        std::mutex bindingMutex_;
+        std::vector<std::unique_ptr<BoundIo>> idleBindings_;
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include "codec.h"
+
+// 流水线中一个阶段的统计, 时间为毫秒
+struct PipelineStageStats {
+    std::string name;
+    size_t items = 0;
+    double busy_ms = 0.0;     // 处理图像
+    double starved_ms = 0.0;  // 等待上一阶段的输出
+    double blocked_ms = 0.0;  // 下一阶段的队列已满
+};
+
+struct PipelineStats {
+    double wall_ms = 0.0;
+    // read, preprocess, g_a, entropy, write, busy_ms / wall_ms 为该阶段的占用率
+    std::vector<PipelineStageStats> stages;
+};
+
+// 多阶段流水线编码: 读图 -> 预处理 -> g_a -> 熵编码 -> 写文件
+// 每个阶段一个线程 (写文件在调用线程), 相邻阶段之间为容量 queue_depth 的队列,
+// 第 k + 1 张图像做 g_a 推理的同时第 k 张在做熵编码和写文件
+// files 为 {输入图像, 输出 .cmpai}, params 提供 quality / 模型 / coding, 与 encode_file 相同
+// 某张图像失败时其余图像继续编码, 全部结束后抛出第一个失败图像的异常
+PipelineStats encode_files_pipelined(const std::vector<std::pair<std::string, std::string>>& files,
+                                     const Params& params, Codec& codec, size_t queue_depth = 2);
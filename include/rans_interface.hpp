@@ -31,8 +31,15 @@
 #pragma once
 
 #include "rans64.h"
+#include <cstddef>
+#include <functional>
+#include <new>
 #include <vector>
 #include <string>
+#include <string_view>
+
+/* Maximum number of interleaved rANS states in one stream */
+constexpr uint32_t rans_max_interleave = 8;
 
 struct RansSymbol {
   uint16_t start;
@@ -40,8 +47,95 @@ struct RansSymbol {
   bool bypass; // bypass flag to write raw bits to the stream
 };
 
-/* NOTE: Warning, we buffer everything for now... In case of large files we
- * should split the bitstream into chunks... Or for a memory-bounded encoder
+/* Allocator aligning the coding tables on cache lines */
+template <typename T> struct CacheAlignedAllocator {
+  using value_type = T;
+  static constexpr size_t alignment = 64;
+
+  CacheAlignedAllocator() = default;
+  template <typename U>
+  CacheAlignedAllocator(const CacheAlignedAllocator<U> &) noexcept {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t(alignment)));
+  }
+  void deallocate(T *p, size_t) noexcept {
+    ::operator delete(p, std::align_val_t(alignment));
+  }
+
+  template <typename U>
+  bool operator==(const CacheAlignedAllocator<U> &) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const CacheAlignedAllocator<U> &) const noexcept {
+    return false;
+  }
+};
+
+template <typename T>
+using cache_aligned_vector = std::vector<T, CacheAlignedAllocator<T>>;
+
+/* Coding tables built once per entropy model (e.g. when the npz is loaded),
+ * all stored contiguously with a fixed stride per cdf, each cdf starting on a
+ * cache line:
+ * - the cdfs themselves,
+ * - precomputed Rans64EncSymbol (reciprocal frequency, no division when
+ *   encoding) and Rans64DecSymbol entries for every symbol,
+ * - a lookup mapping a cumulative frequency to its symbol in constant time
+ *   with a two-level table: the top `lookup_bits` bits of the frequency select
+ *   a slot holding the first candidate symbol, the few symbols sharing that
+ *   slot are then checked. CDFs with at most `linear_search_max` entries are
+ *   still scanned linearly.
+ **/
+class RansCdfTable {
+public:
+  static constexpr int lookup_bits = 12;
+  static constexpr int32_t linear_search_max = 8;
+
+  RansCdfTable() = default;
+  RansCdfTable(const std::vector<std::vector<int32_t>> &cdfs,
+               const std::vector<int32_t> &cdfs_sizes,
+               const std::vector<int32_t> &offsets);
+  /* cdf i starts at cdfs[i * cdfs_stride], e.g. the rows of the npz array */
+  RansCdfTable(const int32_t *cdfs, size_t cdfs_stride,
+               const std::vector<int32_t> &cdfs_sizes,
+               const std::vector<int32_t> &offsets);
+
+  size_t size() const { return cdfs_sizes.size(); }
+
+  /* Returns s such that cdf[s] <= cum_freq < cdf[s + 1] */
+  inline uint32_t find(int32_t cdf_idx, uint32_t cum_freq) const;
+
+  const int32_t *cdf_data(int32_t cdf_idx) const {
+    return _cdf.data() + cdf_idx * _stride;
+  }
+
+  /* Indexed by symbol value, max_value (escape) included */
+  const Rans64EncSymbol *enc_symbols(int32_t cdf_idx) const {
+    return _enc_syms.data() + cdf_idx * _sym_stride;
+  }
+  const Rans64DecSymbol *dec_symbols(int32_t cdf_idx) const {
+    return _dec_syms.data() + cdf_idx * _sym_stride;
+  }
+
+  std::vector<int32_t> cdfs_sizes;
+  std::vector<int32_t> offsets;
+
+private:
+  cache_aligned_vector<int32_t> _cdf; // cdfs packed with a fixed stride
+  size_t _stride = 0;
+  cache_aligned_vector<Rans64EncSymbol> _enc_syms;
+  cache_aligned_vector<Rans64DecSymbol> _dec_syms;
+  size_t _sym_stride = 0;
+  cache_aligned_vector<uint16_t> _lookup;
+
+  void init(const int32_t *cdfs, size_t cdfs_stride);
+};
+
+/* NOTE: Warning, this buffers everything, about 5 bytes per symbol plus the
+ * flush output. See ChunkedRansEncoder for a memory-bounded encoder.
  **/
 class BufferedRansEncoder {
 public:
@@ -58,10 +152,97 @@ public:
                            const std::vector<int32_t> &cdfs_sizes,
                            const std::vector<int32_t> &offsets);
 
-  std::string flush();
+  /* Buffers a single symbol, returns the number of buffered rANS symbols
+   * (bypass symbols included) */
+  size_t encode_symbol(int32_t symbol, int32_t cdf_idx,
+                       const RansCdfTable &table);
+
+  /* Number of buffered symbols, bypass symbols excluded */
+  size_t n_symbols() const { return _n_symbols; }
+
+  /* n_states > 1 interleaves the symbols over that many rANS states (2, 4 or
+   * 8), which is not readable by CompressAI's decoder. */
+  std::string flush(uint32_t n_states = 1);
 
 private:
+  void push_symbol(int32_t value, const int32_t *cdf, int32_t max_value);
+
   std::vector<RansSymbol> _syms;
+  size_t _n_symbols = 0;
+};
+
+/* Encodes straight from the symbol and index arrays, walking them backwards,
+ * into an output buffer kept across calls: once the buffer has grown to the
+ * largest stream, encoding does no heap allocation. Produces the same stream
+ * as BufferedRansEncoder.
+ **/
+class DirectRansEncoder {
+public:
+  DirectRansEncoder() = default;
+
+  DirectRansEncoder(const DirectRansEncoder &) = delete;
+  DirectRansEncoder &operator=(const DirectRansEncoder &) = delete;
+
+  /* The returned view points into the internal buffer and is valid until the
+   * next call */
+  std::string_view encode(const int32_t *symbols, const int32_t *indexes,
+                          size_t size, const RansCdfTable &table,
+                          uint32_t n_states = 1);
+
+  /* Same as encode() for symbols laid out as n_planes planes of plane_size
+   * symbols, plane p coded with cdf first_cdf + p (e.g. the channels of a
+   * CHW latent): no index array is needed. Planes with skip[p] != 0 are left
+   * out of the stream. */
+  std::string_view encode_planes(const int32_t *symbols, size_t plane_size,
+                                 int32_t first_cdf, int32_t n_planes,
+                                 const RansCdfTable &table,
+                                 uint32_t n_states = 1,
+                                 const uint8_t *skip = nullptr);
+
+private:
+  uint32_t *begin(size_t n_puts, uint32_t n_states);
+  std::string_view end(uint32_t *ptr, uint32_t n_states);
+
+  std::vector<uint32_t> _buffer;
+  uint32_t *_end = nullptr;
+  Rans64State _rans[rans_max_interleave];
+};
+
+/* Memory-bounded encoder: once `chunk_symbols` rANS symbols (bypass symbols
+ * included) are buffered they are flushed as an independently decodable
+ * chunk, so the buffers never grow past the budget whatever the input size.
+ *
+ * Stream: a sequence of [uint32 n_symbols][uint32 n_bytes][rANS stream]
+ * chunks, read by RansDecoder::decode_chunked. Not readable by CompressAI.
+ **/
+class ChunkedRansEncoder {
+public:
+  /* Receives each chunk (header included) as soon as it is flushed */
+  using ChunkSink = std::function<void(const std::string &chunk)>;
+
+  /* Without a sink the chunks are appended to the string returned by
+   * flush(), which then only grows with the compressed size. */
+  explicit ChunkedRansEncoder(size_t chunk_symbols, uint32_t n_states = 1,
+                              ChunkSink sink = nullptr);
+
+  ChunkedRansEncoder(const ChunkedRansEncoder &) = delete;
+  ChunkedRansEncoder &operator=(const ChunkedRansEncoder &) = delete;
+
+  void encode_with_indexes(const std::vector<int32_t> &symbols,
+                           const std::vector<int32_t> &indexes,
+                           const RansCdfTable &table);
+
+  /* Flushes the last partial chunk */
+  std::string flush();
+
+private:
+  void flush_chunk();
+
+  BufferedRansEncoder _buffer;
+  size_t _chunk_symbols;
+  uint32_t _n_states;
+  ChunkSink _sink;
+  std::string _stream;
 };
 
 class RansEncoder {
@@ -79,6 +260,10 @@ public:
                                 const std::vector<int32_t> &cdfs_sizes,
                                 const std::vector<int32_t> &offsets);
 
+  std::string encode_with_indexes(const std::vector<int32_t> &symbols,
+                                  const std::vector<int32_t> &indexes,
+                                  const RansCdfTable &table,
+                                  uint32_t n_states = 1);
 };
 
 class RansDecoder {
@@ -97,6 +282,36 @@ public:
                       const std::vector<int32_t> &cdfs_sizes,
                       const std::vector<int32_t> &offsets);
 
+  std::vector<int32_t> decode_with_indexes(const std::string &encoded,
+                                           const std::vector<int32_t> &indexes,
+                                           const RansCdfTable &table,
+                                           uint32_t n_states = 1);
+
+  /* Decodes a DirectRansEncoder::encode_planes stream straight into the
+   * dequantized output: output[p * plane_size + j] = value + bias[p].
+   * Skipped planes are not written. */
+  void decode_planes(const std::string &encoded, size_t plane_size,
+                     int32_t first_cdf, int32_t n_planes,
+                     const RansCdfTable &table, const float *bias,
+                     float *output, uint32_t n_states = 1,
+                     const uint8_t *skip = nullptr);
+  /* Same, reading the stream in place; encoded must be 4-byte aligned */
+  void decode_planes(const char *encoded, size_t size, size_t plane_size,
+                     int32_t first_cdf, int32_t n_planes,
+                     const RansCdfTable &table, const float *bias,
+                     float *output, uint32_t n_states = 1,
+                     const uint8_t *skip = nullptr);
+
+  /* Decodes a ChunkedRansEncoder stream */
+  std::vector<int32_t> decode_chunked(const std::string &encoded,
+                                      const std::vector<int32_t> &indexes,
+                                      const RansCdfTable &table,
+                                      uint32_t n_states = 1);
+  std::vector<int32_t> decode_chunked(const char *encoded, size_t size,
+                                      const std::vector<int32_t> &indexes,
+                                      const RansCdfTable &table,
+                                      uint32_t n_states = 1);
+
   void set_stream(const std::string &stream);
 
   std::vector<int32_t>
@@ -105,6 +320,8 @@ public:
                 const std::vector<int32_t> &cdfs_sizes,
                 const std::vector<int32_t> &offsets);
 
+  std::vector<int32_t> decode_stream(const std::vector<int32_t> &indexes,
+                                     const RansCdfTable &table);
 
 private:
   Rans64State _rans;
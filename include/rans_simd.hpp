@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rans_interface.hpp"
+
+struct RansWordTables; // rans_word_sse41.h
+
+/* 8-lane rANS coder built on ryg_rans' rans_word_sse41.h (32-bit states,
+ * 16-bit word IO, 12-bit probabilities).
+ *
+ * The symbols are grouped into steps of up to 8 consecutive symbols sharing
+ * the same cdf index; symbol j of a step is coded by lane j. For a channel
+ * major latent a step is 8 neighbouring positions of one channel, so all the
+ * lanes of a step read the same table. Escaped values (max_value symbol) are
+ * stored as varints after the rANS words instead of bypass coded, which keeps
+ * the decoder loop branch free.
+ *
+ * Stream: [uint32 size of rANS part in bytes][rANS words][escape varints]
+ *
+ * Not compatible with CompressAI, both sides must use this coder.
+ **/
+constexpr uint32_t rans_simd_lanes = 8;
+
+/* Per-cdf decoding tables with the cdfs requantized to 12 bits */
+class RansSimdTable {
+public:
+  explicit RansSimdTable(const RansCdfTable &table);
+  ~RansSimdTable();
+
+  RansSimdTable(const RansSimdTable &) = delete;
+  RansSimdTable &operator=(const RansSimdTable &) = delete;
+
+  size_t size() const { return max_values.size(); }
+
+  const RansWordTables *tables(int32_t cdf_idx) const;
+
+  std::vector<uint16_t> start; // [cdf_idx * stride + s]
+  std::vector<uint16_t> freq;
+  size_t stride = 0;
+  std::vector<int32_t> max_values;
+  std::vector<int32_t> offsets;
+
+private:
+  std::unique_ptr<RansWordTables[]> _tables;
+};
+
+class RansSimdEncoder {
+public:
+  RansSimdEncoder() = default;
+
+  RansSimdEncoder(const RansSimdEncoder &) = delete;
+  RansSimdEncoder &operator=(const RansSimdEncoder &) = delete;
+
+  std::string encode_with_indexes(const std::vector<int32_t> &symbols,
+                                  const std::vector<int32_t> &indexes,
+                                  const RansSimdTable &table);
+};
+
+class RansSimdDecoder {
+public:
+  RansSimdDecoder() = default;
+
+  RansSimdDecoder(const RansSimdDecoder &) = delete;
+  RansSimdDecoder &operator=(const RansSimdDecoder &) = delete;
+
+  std::vector<int32_t> decode_with_indexes(const std::string &encoded,
+                                           const std::vector<int32_t> &indexes,
+                                           const RansSimdTable &table);
+  std::vector<int32_t> decode_with_indexes(const char *encoded,
+                                           size_t encoded_size,
+                                           const std::vector<int32_t> &indexes,
+                                           const RansSimdTable &table);
+
+private:
+  std::vector<uint16_t> _words; // rANS part, padded for the SIMD reads
+};
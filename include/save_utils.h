@@ -8,6 +8,7 @@
 #include <vector>
 #include <map>
 #include <string>
+#include "coding_options.h"
 
 
 
@@ -34,6 +35,10 @@ struct fileInfo {
     uint32_t n_strings;
     std::vector<uint32_t> length_strings;
     std::vector<std::string> strings;
+    CodingOptions coding = CodingOptions();
+    // g_a 输入上方和左侧的填充, 只在扩展头中保存, coding.minimal_padding 时解码按此裁剪
+    uint32_t pad_top = 0;
+    uint32_t pad_left = 0;
 };
 
 
@@ -44,6 +49,8 @@ std::string read_bytes(std::ifstream& file, int n);
 void write_uint32(std::ofstream& file, uint32_t value, int n = 1);
 void write_uchar(std::ofstream& file, char value, int n = 1);
 void write_bytes(std::ofstream& file, const std::string& value);
+void write_coding_options(std::ofstream& file, const CodingOptions& coding, uint32_t pad_top, uint32_t pad_left);
+CodingOptions read_coding_options(std::ifstream& file, uint32_t& pad_top, uint32_t& pad_left);
 fileInfo load(const std::string& filename);
 void save(const fileInfo& info, const std::string& output_path);
 void build_code(char metric, char quality, char& code);
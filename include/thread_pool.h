@@ -0,0 +1,34 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// 固定大小的线程池, 用于熵编码等 CPU 密集任务
+class ThreadPool {
+    public:
+        // n_threads 为 0 时使用 std::thread::hardware_concurrency()
+        explicit ThreadPool(size_t n_threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        size_t size() const { return workers_.size(); }
+
+        // 并行执行 fn(0) ... fn(n - 1), 调用线程也参与执行, 全部完成后返回
+        // 任务抛出的第一个异常会在调用线程重新抛出
+        void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+
+    private:
+        void worker_loop();
+
+        std::vector<std::thread> workers_;
+        std::queue<std::function<void()>> jobs_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stop_ = false;
+};
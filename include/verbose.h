@@ -0,0 +1,13 @@
+#pragma once
+#include <atomic>
+
+// 诊断输出 (张量形状, 子码流大小, 文件头字段, 每次推理的耗时) 的开关, 进程内共享, 默认关闭
+// cmpai-cli 的 --verbose 打开, 编解码的热路径上只在打开时才输出
+inline std::atomic<bool>& verbose_flag() {
+    static std::atomic<bool> flag{false};
+    return flag;
+}
+
+inline void set_verbose(bool on) { verbose_flag().store(on, std::memory_order_relaxed); }
+
+inline bool verbose() { return verbose_flag().load(std::memory_order_relaxed); }
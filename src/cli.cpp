@@ -1,21 +1,159 @@
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
 #include "codec.h"
+#include "verbose.h"
+#include "pipeline_encoder.h"
 
 
 void print_help(char* argv[]) {
     std::cerr << "-----------Only Support bmshj2018-factorized Model-----------" << std::endl;
     std::cerr << "-----------Default Model Path: ./models/bmshj2018-factorized-mse-q3-g_a.onnx-----------" << std::endl;
     std::cerr << "-----------set env AICODEC_MODEL_DIR to set model_dir-----------" << std::endl;
-    std::cerr << "Usage: " << argv[0] << " encode <image_path> <output_file>" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " encode <image_path> <output_file> [options]" << std::endl;
     std::cerr << "Example: " << argv[0] << " encode /path/to/image.jpg /path/to/output.cmpai" << std::endl;
+    std::cerr << "Options (non-default values are not readable by CompressAI):" << std::endl;
+    std::cerr << "  --interleave <1|2|4|8>   number of interleaved rANS states, default 1" << std::endl;
+    std::cerr << "  --simd                   8-lane SIMD rANS coder, faster decoding" << std::endl;
+    std::cerr << "  --substreams <K>         split the latent into K channel groups coded in parallel, default 1" << std::endl;
+    std::cerr << "  --chunk-symbols <N>      flush the rANS encoder every N symbols to bound its memory, default 0 (off)" << std::endl;
+    std::cerr << "  --skip-constant          signal constant latent channels in a bitmap instead of rANS coding them" << std::endl;
+    std::cerr << "  --minimal-padding        pad the g_a input to a multiple of 16 instead of 64, padding stored in the header" << std::endl;
+    std::cerr << "  --spatial-tile <pixels>  code the latent in independent tiles of this size (multiple of 16) for decode --region" << std::endl;
+    std::cerr << "Inference options (encode and decode):" << std::endl;
+    std::cerr << "  --tile <pixels>          run g_a / g_s on tiles of this size to bound memory, multiple of 16, default 0 (off)" << std::endl;
+    std::cerr << "  --tile-overlap <pixels>  extra context computed around each tile, multiple of 16, default 64" << std::endl;
+    std::cerr << "  --model-cache <dir>      cache optimized ONNX models in dir, default env AICODEC_MODEL_CACHE_DIR" << std::endl;
+    std::cerr << "  --precision <fp32|int8|fp16|bf16>  g_a / g_s model precision, int8 needs *.int8.onnx from tools/quantize_int8.py," << std::endl;
+    std::cerr << "                           fp16 / bf16 need *.fp16.onnx / *.bf16.onnx and fall back to fp32 without AVX512-FP16 / BF16" << std::endl;
+    std::cerr << "  --provider <cpu|openvino|xnnpack|dnnl>  ORT execution provider, falls back to cpu when unavailable" << std::endl;
+    std::cerr << "  --threads <N>            ORT intra-op threads shared by all sessions, default env AICODEC_ORT_INTRA_THREADS or all cores" << std::endl;
+    std::cerr << "  --verbose                print tensor shapes, substream sizes, file header fields and per-run inference time" << std::endl;
     std::cerr << "--------------------------------" << std::endl;
-    std::cerr << "Usage: " << argv[0] << " decode <compressed_file> <output_image_path>" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " encode-batch <output_dir> <image_path>... [options] [--queue-depth <N>]" << std::endl;
+    std::cerr << "Example: " << argv[0] << " encode-batch /path/to/out a.jpg b.jpg c.jpg --simd" << std::endl;
+    std::cerr << "  pipelined encoding to <output_dir>/<image name>.cmpai, reports per-stage occupancy" << std::endl;
+    std::cerr << "--------------------------------" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " decode <compressed_file> <output_image_path> [inference options] [--region <x,y,w,h>]" << std::endl;
     std::cerr << "Example: " << argv[0] << " decode /path/to/compressed.cmpai /path/to/output.jpg" << std::endl;
+    std::cerr << "  --region decodes only that rectangle, the file must be encoded with --spatial-tile" << std::endl;
+    std::cerr << "--------------------------------" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " eval <image_path> [options] [--max-psnr-drop <dB>] [--max-bpp-increase <%>] [--repeat <N>]" << std::endl;
+    std::cerr << "Example: " << argv[0] << " eval assets/stmalo_fracape.png --precision int8" << std::endl;
+    std::cerr << "  reports PSNR, bpp and encode / decode time against FP32, exits with 2 when the change exceeds the limits" << std::endl;
+    std::cerr << "  (default 0.5 dB and 5%)" << std::endl;
+    std::cerr << "--------------------------------" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " bench <image_path> [inference options] [--providers <p1,p2,...>] [--repeat <N>]" << std::endl;
+    std::cerr << "Example: " << argv[0] << " bench assets/stmalo_fracape.png --providers cpu,openvino,xnnpack,dnnl" << std::endl;
+    std::cerr << "  times g_a / g_s on the same input under each execution provider, default all of them" << std::endl;
+    std::cerr << "--------------------------------" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " padding <image_path>... [options] [--repeat <N>]" << std::endl;
+    std::cerr << "Example: " << argv[0] << " padding a.jpg b.png c.png" << std::endl;
+    std::cerr << "  compares 64-aligned and --minimal-padding encoding: g_a / g_s FLOPs, time, PSNR and bpp per image and in total" << std::endl;
     std::cerr << "--------------------------------" << std::endl;   
 }
 
 
+// 解析可选参数, coding 为 nullptr 时 (decode) 不接受码流选项, 失败返回 false
+bool parse_options(int argc, char* argv[], int first, CodingOptions* coding, InferenceOptions& inference) {
+    for (int i = first; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--tile" && i + 1 < argc) {
+            long n = std::atol(argv[++i]);
+            if (n < 0 || n % 16 != 0 || n > 0xFFFFFFFFL) {
+                std::cerr << "--tile must be a non-negative multiple of 16" << std::endl;
+                return false;
+            }
+            inference.tile_size = static_cast<uint32_t>(n);
+        } else if (arg == "--tile-overlap" && i + 1 < argc) {
+            long n = std::atol(argv[++i]);
+            if (n < 0 || n % 16 != 0 || n > 0xFFFFFFFFL) {
+                std::cerr << "--tile-overlap must be a non-negative multiple of 16" << std::endl;
+                return false;
+            }
+            inference.tile_overlap = static_cast<uint32_t>(n);
+        } else if (arg == "--model-cache" && i + 1 < argc) {
+            inference.optimized_model_cache_dir = argv[++i];
+        } else if (arg == "--precision" && i + 1 < argc) {
+            const std::string precision = argv[++i];
+            if (precision == "fp32") {
+                inference.precision = ModelPrecision::Fp32;
+            } else if (precision == "int8") {
+                inference.precision = ModelPrecision::Int8;
+            } else if (precision == "fp16") {
+                inference.precision = ModelPrecision::Fp16;
+            } else if (precision == "bf16") {
+                inference.precision = ModelPrecision::Bf16;
+            } else {
+                std::cerr << "--precision must be fp32, int8, fp16 or bf16" << std::endl;
+                return false;
+            }
+        } else if (arg == "--provider" && i + 1 < argc) {
+            if (!parse_execution_provider(argv[++i], inference.provider)) {
+                std::cerr << "--provider must be cpu, openvino, xnnpack or dnnl" << std::endl;
+                return false;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            int n = std::atoi(argv[++i]);
+            if (n < 0) {
+                std::cerr << "--threads must be non-negative" << std::endl;
+                return false;
+            }
+            OrtThreadOptions threads = ort_thread_options();
+            threads.intra_op_threads = static_cast<uint32_t>(n);
+            set_ort_thread_options(threads);
+        } else if (arg == "--verbose") {
+            set_verbose(true);
+        } else if (coding == nullptr) {
+            std::cerr << "unknown option: " << arg << std::endl;
+            return false;
+        } else if (arg == "--interleave" && i + 1 < argc) {
+            int n = std::atoi(argv[++i]);
+            if (n != 1 && n != 2 && n != 4 && n != 8) {
+                std::cerr << "--interleave must be 1, 2, 4 or 8" << std::endl;
+                return false;
+            }
+            coding->rans_interleave = static_cast<uint8_t>(n);
+        } else if (arg == "--simd") {
+            coding->entropy_coder = EntropyCoder::RansSimd;
+        } else if (arg == "--substreams" && i + 1 < argc) {
+            int n = std::atoi(argv[++i]);
+            if (n < 1 || n > 255) {
+                std::cerr << "--substreams must be in [1, 255]" << std::endl;
+                return false;
+            }
+            coding->n_substreams = static_cast<uint8_t>(n);
+        } else if (arg == "--chunk-symbols" && i + 1 < argc) {
+            long n = std::atol(argv[++i]);
+            if (n < 0 || n > 0xFFFFFFFFL) {
+                std::cerr << "--chunk-symbols must be in [0, 4294967295]" << std::endl;
+                return false;
+            }
+            coding->rans_chunk_symbols = static_cast<uint32_t>(n);
+        } else if (arg == "--skip-constant") {
+            coding->skip_constant_channels = true;
+        } else if (arg == "--minimal-padding") {
+            coding->minimal_padding = true;
+        } else if (arg == "--spatial-tile" && i + 1 < argc) {
+            long n = std::atol(argv[++i]);
+            if (n < 16 || n % 16 != 0 || n / 16 > 0xFFFF) {
+                std::cerr << "--spatial-tile must be a positive multiple of 16" << std::endl;
+                return false;
+            }
+            coding->spatial_tile = static_cast<uint16_t>(n / 16);
+        } else {
+            std::cerr << "unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
 int main(int argc, char* argv[])
 
 {
@@ -29,7 +167,7 @@ int main(int argc, char* argv[])
     const std::string& mode = argv[1];
 
     if (mode == "encode") {
-        if (argc != 4) {
+        if (argc < 4) {
             print_help(argv);
             return 1;
         }
@@ -50,10 +188,71 @@ int main(int argc, char* argv[])
             metric_name,
             nullptr,
             "",
+            CodingOptions(),
+        };
+        InferenceOptions inference;
+        inference.optimized_model_cache_dir = std::getenv("AICODEC_MODEL_CACHE_DIR") ? std::getenv("AICODEC_MODEL_CACHE_DIR") : "";
+        if (!parse_options(argc, argv, 4, &params.coding, inference)) {
+            print_help(argv);
+            return 1;
+        }
+        encode_file(image_path, output_file, params, model_dir, inference);
+    } else if (mode == "encode-batch") {
+        if (argc < 4) {
+            print_help(argv);
+            return 1;
+        }
+
+        const std::filesystem::path output_dir = argv[2];
+        const std::string model_dir = std::getenv("AICODEC_MODEL_DIR") ? std::getenv("AICODEC_MODEL_DIR") : "./models";
+        Params params = {
+            '3',
+            0,
+            0,
+            0,
+            0,
+            "bmshj2018-factorized",
+            "mse",
+            nullptr,
+            "",
+            CodingOptions(),
         };
-        encode_file(image_path, output_file, params, model_dir);
+        // 输出文件为 <output_dir>/<图像文件名去掉扩展名>.cmpai
+        std::vector<std::pair<std::string, std::string>> files;
+        int first = 3;
+        for (; first < argc && std::string(argv[first]).rfind("--", 0) != 0; first++) {
+            const std::filesystem::path image_path = argv[first];
+            files.emplace_back(image_path.string(), (output_dir / image_path.stem()).string() + ".cmpai");
+        }
+        size_t queue_depth = 2;
+        std::vector<char*> rest(argv, argv + first);
+        for (int i = first; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--queue-depth" && i + 1 < argc) {
+                queue_depth = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+            } else {
+                rest.push_back(argv[i]);
+            }
+        }
+        InferenceOptions inference;
+        inference.optimized_model_cache_dir = std::getenv("AICODEC_MODEL_CACHE_DIR") ? std::getenv("AICODEC_MODEL_CACHE_DIR") : "";
+        if (files.empty() || !parse_options(static_cast<int>(rest.size()), rest.data(), first, &params.coding, inference)) {
+            print_help(argv);
+            return 1;
+        }
+
+        std::filesystem::create_directories(output_dir);
+        Codec codec(model_dir, params.model_name, params.metric_name, params.quality, inference);
+        PipelineStats stats = encode_files_pipelined(files, params, codec, queue_depth);
+        std::printf("%zu images in %.1f ms\n", files.size(), stats.wall_ms);
+        std::printf("%-12s %8s %12s %12s %12s %10s\n", "stage", "images", "busy(ms)", "starved(ms)", "blocked(ms)",
+                    "occupancy");
+        for (const auto& stage : stats.stages) {
+            std::printf("%-12s %8zu %12.1f %12.1f %12.1f %9.1f%%\n", stage.name.c_str(), stage.items, stage.busy_ms,
+                        stage.starved_ms, stage.blocked_ms, 100.0 * stage.busy_ms / stats.wall_ms);
+        }
     } else if (mode == "decode") {  
-        if (argc != 4) {
+        if (argc < 4) {
             print_help(argv);
             return 1;
         }
@@ -61,7 +260,205 @@ int main(int argc, char* argv[])
         const std::string& compressed_file = argv[2];
         const std::string& output_image_path = argv[3];
         const std::string model_dir = std::getenv("AICODEC_MODEL_DIR") ? std::getenv("AICODEC_MODEL_DIR") : "./models";
-        decode_file(compressed_file, output_image_path, model_dir);
+        bool has_region = false;
+        unsigned int region[4] = {0, 0, 0, 0};
+        std::vector<char*> rest(argv, argv + 4);
+        for (int i = 4; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--region" && i + 1 < argc) {
+                if (std::sscanf(argv[++i], "%u,%u,%u,%u", &region[0], &region[1], &region[2], &region[3]) != 4) {
+                    std::cerr << "--region must be x,y,w,h" << std::endl;
+                    return 1;
+                }
+                has_region = true;
+            } else {
+                rest.push_back(argv[i]);
+            }
+        }
+        InferenceOptions inference;
+        inference.optimized_model_cache_dir = std::getenv("AICODEC_MODEL_CACHE_DIR") ? std::getenv("AICODEC_MODEL_CACHE_DIR") : "";
+        if (!parse_options(static_cast<int>(rest.size()), rest.data(), 4, nullptr, inference)) {
+            print_help(argv);
+            return 1;
+        }
+        if (has_region) {
+            decode_file_region(compressed_file, output_image_path, region[0], region[1], region[2], region[3],
+                               model_dir, inference);
+        } else {
+            decode_file(compressed_file, output_image_path, model_dir, inference);
+        }
+    } else if (mode == "eval") {
+        if (argc < 3) {
+            print_help(argv);
+            return 1;
+        }
+
+        const std::string& image_path = argv[2];
+        const std::string model_name = "bmshj2018-factorized";
+        const std::string metric_name = "mse";
+        const char quality = '3';
+        const std::string model_dir = std::getenv("AICODEC_MODEL_DIR") ? std::getenv("AICODEC_MODEL_DIR") : "./models";
+        double max_psnr_drop = 0.5;
+        double max_bpp_increase = 5.0;
+        int repeat = 3;
+        std::vector<char*> rest(argv, argv + 3);
+        for (int i = 3; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--max-psnr-drop" && i + 1 < argc) {
+                max_psnr_drop = std::atof(argv[++i]);
+            } else if (arg == "--max-bpp-increase" && i + 1 < argc) {
+                max_bpp_increase = std::atof(argv[++i]);
+            } else if (arg == "--repeat" && i + 1 < argc) {
+                repeat = std::atoi(argv[++i]);
+            } else {
+                rest.push_back(argv[i]);
+            }
+        }
+        CodingOptions coding;
+        InferenceOptions inference;
+        inference.optimized_model_cache_dir = std::getenv("AICODEC_MODEL_CACHE_DIR") ? std::getenv("AICODEC_MODEL_CACHE_DIR") : "";
+        if (!parse_options(static_cast<int>(rest.size()), rest.data(), 3, &coding, inference)) {
+            print_help(argv);
+            return 1;
+        }
+
+        // 基准为相同选项下的 FP32 模型
+        InferenceOptions reference_inference = inference;
+        reference_inference.precision = ModelPrecision::Fp32;
+        EvalResult reference;
+        {
+            Codec codec(model_dir, model_name, metric_name, quality, reference_inference);
+            reference = evaluate_file(image_path, codec, coding, repeat);
+        }
+        EvalResult result = reference;
+        if (inference.precision != ModelPrecision::Fp32) {
+            Codec codec(model_dir, model_name, metric_name, quality, inference);
+            result = evaluate_file(image_path, codec, coding, repeat);
+        }
+
+        const double psnr_drop = reference.psnr - result.psnr;
+        const double bpp_increase = (result.bpp / reference.bpp - 1.0) * 100.0;
+        std::printf("%-8s %10s %10s %12s %12s\n", "", "PSNR(dB)", "bpp", "encode(ms)", "decode(ms)");
+        std::printf("%-8s %10.3f %10.4f %12.1f %12.1f\n", "fp32", reference.psnr, reference.bpp, reference.encode_ms,
+                    reference.decode_ms);
+        std::printf("%-8s %10.3f %10.4f %12.1f %12.1f\n", "selected", result.psnr, result.bpp, result.encode_ms,
+                    result.decode_ms);
+        std::printf("PSNR change %+.3f dB, bpp change %+.2f%%, encode speedup %.2fx, decode speedup %.2fx\n",
+                    -psnr_drop, bpp_increase, reference.encode_ms / result.encode_ms,
+                    reference.decode_ms / result.decode_ms);
+        if (psnr_drop > max_psnr_drop || bpp_increase > max_bpp_increase) {
+            std::printf("FAIL: limits are %.3f dB and %.2f%%\n", max_psnr_drop, max_bpp_increase);
+            return 2;
+        }
+        std::printf("PASS\n");
+    } else if (mode == "bench") {
+        if (argc < 3) {
+            print_help(argv);
+            return 1;
+        }
+
+        const std::string& image_path = argv[2];
+        const std::string model_dir = std::getenv("AICODEC_MODEL_DIR") ? std::getenv("AICODEC_MODEL_DIR") : "./models";
+        std::vector<ExecutionProvider> providers = {ExecutionProvider::Cpu, ExecutionProvider::OpenVino,
+                                                    ExecutionProvider::Xnnpack, ExecutionProvider::Dnnl};
+        int repeat = 3;
+        std::vector<char*> rest(argv, argv + 3);
+        for (int i = 3; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--providers" && i + 1 < argc) {
+                providers.clear();
+                std::string list = argv[++i];
+                size_t begin = 0;
+                while (begin <= list.size()) {
+                    size_t end = std::min(list.find(',', begin), list.size());
+                    ExecutionProvider provider;
+                    if (!parse_execution_provider(list.substr(begin, end - begin), provider)) {
+                        std::cerr << "unknown provider: " << list.substr(begin, end - begin) << std::endl;
+                        return 1;
+                    }
+                    providers.push_back(provider);
+                    begin = end + 1;
+                }
+            } else if (arg == "--repeat" && i + 1 < argc) {
+                repeat = std::atoi(argv[++i]);
+            } else {
+                rest.push_back(argv[i]);
+            }
+        }
+        InferenceOptions inference;
+        inference.optimized_model_cache_dir = std::getenv("AICODEC_MODEL_CACHE_DIR") ? std::getenv("AICODEC_MODEL_CACHE_DIR") : "";
+        if (!parse_options(static_cast<int>(rest.size()), rest.data(), 3, nullptr, inference)) {
+            print_help(argv);
+            return 1;
+        }
+
+        Codec codec(model_dir, "bmshj2018-factorized", "mse", '3', inference);
+        std::vector<ProviderBenchmark> results = codec.benchmark_providers(image_path, providers, repeat);
+        std::printf("%-10s %-10s %10s %10s %10s %12s\n", "provider", "used", "load(ms)", "g_a(ms)", "g_s(ms)",
+                    "max diff");
+        for (const auto& result : results) {
+            std::printf("%-10s %-10s %10.1f %10.1f %10.1f %12.2e\n", execution_provider_name(result.requested),
+                        execution_provider_name(result.used), result.load_ms, result.g_a_ms, result.g_s_ms,
+                        result.max_abs_diff);
+        }
+    } else if (mode == "padding") {
+        if (argc < 3) {
+            print_help(argv);
+            return 1;
+        }
+
+        const std::string model_dir = std::getenv("AICODEC_MODEL_DIR") ? std::getenv("AICODEC_MODEL_DIR") : "./models";
+        std::vector<std::string> images;
+        int first = 2;
+        for (; first < argc && std::string(argv[first]).rfind("--", 0) != 0; first++) {
+            images.push_back(argv[first]);
+        }
+        int repeat = 3;
+        std::vector<char*> rest(argv, argv + first);
+        for (int i = first; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--repeat" && i + 1 < argc) {
+                repeat = std::atoi(argv[++i]);
+            } else {
+                rest.push_back(argv[i]);
+            }
+        }
+        CodingOptions coding;
+        InferenceOptions inference;
+        inference.optimized_model_cache_dir = std::getenv("AICODEC_MODEL_CACHE_DIR") ? std::getenv("AICODEC_MODEL_CACHE_DIR") : "";
+        if (images.empty() || !parse_options(static_cast<int>(rest.size()), rest.data(), first, &coding, inference)) {
+            print_help(argv);
+            return 1;
+        }
+
+        // 两种填充使用同一个 Codec, 只有 coding.minimal_padding 不同
+        Codec codec(model_dir, "bmshj2018-factorized", "mse", '3', inference);
+        CodingOptions aligned = coding;
+        aligned.minimal_padding = false;
+        CodingOptions minimal = coding;
+        minimal.minimal_padding = true;
+        // g_a / g_s 的计算量与填充后的面积成正比, 用面积之比表示 FLOPs 之比
+        double aligned_area = 0.0, minimal_area = 0.0;
+        double aligned_ms = 0.0, minimal_ms = 0.0;
+        std::printf("%-24s %11s %11s %11s %7s %16s %14s %16s\n", "image", "size", "64-aligned", "minimal", "FLOPs",
+                    "enc+dec(ms)", "PSNR(dB)", "bpp");
+        for (const auto& image : images) {
+            const EvalResult a = evaluate_file(image, codec, aligned, repeat);
+            const EvalResult m = evaluate_file(image, codec, minimal, repeat);
+            const double area_a = static_cast<double>(padded_size(a.height)) * padded_size(a.width);
+            const double area_m = static_cast<double>(padded_size(m.height, true)) * padded_size(m.width, true);
+            aligned_area += area_a;
+            minimal_area += area_m;
+            aligned_ms += a.encode_ms + a.decode_ms;
+            minimal_ms += m.encode_ms + m.decode_ms;
+            const std::string name = std::filesystem::path(image).filename().string();
+            std::printf("%-24s %5ux%-5u %5ux%-5u %5ux%-5u %6.1f%% %7.1f -> %6.1f %6.2f -> %5.2f %6.4f -> %5.4f\n",
+                        name.c_str(), a.width, a.height, padded_size(a.width), padded_size(a.height),
+                        padded_size(a.width, true), padded_size(a.height, true), 100.0 * (area_m / area_a - 1.0),
+                        a.encode_ms + a.decode_ms, m.encode_ms + m.decode_ms, a.psnr, m.psnr, a.bpp, m.bpp);
+        }
+        std::printf("total: FLOPs %+.1f%%, encode + decode time %.1f -> %.1f ms (%.2fx)\n",
+                    100.0 * (minimal_area / aligned_area - 1.0), aligned_ms, minimal_ms, aligned_ms / minimal_ms);
     } else {
         print_help(argv);
         return 1;
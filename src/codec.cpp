@@ -3,7 +3,11 @@
 #include <opencv2/imgcodecs.hpp>
 #include <onnxruntime_cxx_api.h>
 #include <cpu_provider_factory.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <iostream>
+#include <map>
 #include <string>
 #include <fstream>
 #include <vector>
@@ -11,106 +15,412 @@
 #include "entropy_bottleneck.h"
 #include "codec.h"
 #include "onnx_model_wrapper.h"
+#include "half_convert.h"
+#include "image_convert.h"
 
-xt::xarray<float> ptr2xarray(const std::shared_ptr<uint8_t>& rgb_data, 
-                            uint32_t original_width, uint32_t original_height) {
-    size_t total_size = static_cast<size_t>(original_height * original_width * 3);
-
-    // RGB
-    auto img_hwc = xt::adapt(rgb_data.get(), 
-                    total_size, 
-                    xt::no_ownership(), 
-                    std::vector<size_t>{original_height, original_width, 3});
-    auto img_chw = xt::transpose(img_hwc, {2, 0, 1});
-    auto img_1chw = xt::expand_dims(img_chw, 0);
-    xt::xarray<float> input_data_4d = xt::eval(img_1chw / 255.0);
-    return input_data_4d;
-}
-
-
-auto pad4d(const xt::xarray<float>& x, uint32_t p=64) {
-    uint32_t h = xt::adapt(x.shape())[2];
-    uint32_t w = xt::adapt(x.shape())[3];
-    uint32_t pad_h = (h + p - 1) / p * p;
-    uint32_t pad_w = (w + p - 1) / p * p;
-    const std::vector<std::vector<uint32_t>> pad_vector = {{0, 0}, {0, 0}, {(pad_h - h) / 2, (pad_h - h) / 2}, {(pad_w - w) / 2, (pad_w - w) / 2}};
-    // N C H W
-    std::cout << "----------pad_h: " << pad_h << std::endl;
-    std::cout << "----------pad_w: " << pad_w << std::endl;
-    auto x_pad = xt::pad(x, pad_vector);
-    std::cout << "----------x_pad.shape: " << xt::adapt(x_pad.shape()) << std::endl;
-    return x_pad;
-}
-
-auto crop4d(const xt::xarray<float>& x, uint32_t original_height, uint32_t original_width) {
-    uint32_t h = xt::adapt(x.shape())[2];
-    uint32_t w = xt::adapt(x.shape())[3];
-    uint32_t crop_h = std::min(h, original_height);
-    uint32_t crop_w = std::min(w, original_width);
-    // N C H W
-    auto x_crop = xt::view(x, xt::all(), xt::all(), 
-                  xt::range((h - crop_h) / 2, (h - crop_h) / 2 + original_height), 
-                  xt::range((w - crop_w) / 2, (w - crop_w) / 2 + original_width));
-    return x_crop;
+namespace {
+
+// 只支持 bmshj2018-factorized 系列
+bool is_supported_model(const std::string& model_name) {
+    return model_name == "bmshj2018-factorized" || model_name == "bmshj2018-factorized_relu";
 }
 
-void encode_buffer(Params& params, const std::string& model_dir) {
-    std::string model_name = params.model_name;
-    std::string metric_name = params.metric_name;
-    char quality = params.quality;
-    uint32_t original_width = params.original_width; // 原始图像宽度
-    uint32_t original_height = params.original_height; // 原始图像高度
+// 文件头中的 quality 为数字 (parse_code), 命令行中为字符 '1' - '8', 统一成数字
+int quality_number(char quality) {
+    return quality >= '0' ? quality - '0' : quality;
+}
+
+// 一维分块: 块内部为 [begin, end), 加上重叠后实际推理的范围为 [margin_begin, margin_end)
+struct TileRange {
+    uint32_t begin;
+    uint32_t end;
+    uint32_t margin_begin;
+    uint32_t margin_end;
+};
 
+std::vector<TileRange> tile_ranges(uint32_t size, uint32_t tile, uint32_t overlap) {
+    std::vector<TileRange> ranges;
+    for (uint32_t begin = 0; begin < size; begin += tile) {
+        const uint32_t end = std::min(size, begin + tile);
+        ranges.push_back({begin, end, begin > overlap ? begin - overlap : 0, std::min(size, end + overlap)});
+    }
+    return ranges;
+}
+
+// g_a 输入前面的填充: 补到 64 (minimal_padding 时为 16) 的倍数, 前面补一半
+uint32_t pad_before(uint32_t size, bool minimal_padding = false) {
+    const uint32_t p = minimal_padding ? 16 : 64;
+    return ((size + p - 1) / p * p - size) / 2;
+}
+
+// 解码输出在 g_s 输出 (height x width) 中的左上角: minimal_padding 时为文件中记录的填充, 否则居中裁剪
+void crop_origin(const Params& params, uint32_t height, uint32_t width, uint32_t& top, uint32_t& left) {
+    if (params.coding.minimal_padding) {
+        if (params.pad_top + params.original_height > height || params.pad_left + params.original_width > width) {
+            throw std::runtime_error("padding does not match the latent size");
+        }
+        top = params.pad_top;
+        left = params.pad_left;
+        return;
+    }
+    top = (height - std::min(height, params.original_height)) / 2;
+    left = (width - std::min(width, params.original_width)) / 2;
+}
+
+// 检查 image, 返回指向 ROI 左上角、stride 已确定、尺寸为 ROI 尺寸的视图
+ImageView resolve_view(const ImageView& image) {
+    if (image.data == nullptr) {
+        throw std::runtime_error("image data is nullptr");
+    }
+    if (image.width == 0 || image.height == 0) {
+        throw std::runtime_error("image is empty");
+    }
+    const size_t stride = image.stride == 0 ? static_cast<size_t>(image.width) * 3 : image.stride;
+    if (stride < static_cast<size_t>(image.width) * 3) {
+        throw std::runtime_error("image stride " + std::to_string(stride) + " is smaller than width * 3");
+    }
+    const bool whole = image.roi_width == 0 || image.roi_height == 0;
+    const uint32_t x = whole ? 0 : image.roi_x;
+    const uint32_t y = whole ? 0 : image.roi_y;
+    const uint32_t width = whole ? image.width : image.roi_width;
+    const uint32_t height = whole ? image.height : image.roi_height;
+    if (x > image.width || width > image.width - x || y > image.height || height > image.height - y) {
+        throw std::runtime_error("roi is outside the image");
+    }
+
+    ImageView view;
+    view.data = image.data + static_cast<size_t>(y) * stride + static_cast<size_t>(x) * 3;
+    view.width = width;
+    view.height = height;
+    view.stride = stride;
+    view.order = image.order;
+    return view;
+}
+
+// params.rgb_data 为紧密排列的 RGB8
+ImageView packed_rgb_view(const Params& params) {
     if (params.rgb_data == nullptr) {
         throw std::runtime_error("rgb_data is nullptr");
     }
+    ImageView view;
+    view.data = params.rgb_data.get();
+    view.width = params.original_width;
+    view.height = params.original_height;
+    return view;
+}
+
+// cv::imread 得到的 BGR 图像, 按 Mat 的 step 直接读取
+ImageView bgr_mat_view(const cv::Mat& image) {
+    ImageView view;
+    view.data = image.data;
+    view.width = image.cols;
+    view.height = image.rows;
+    view.stride = image.step;
+    view.order = ChannelOrder::Bgr;
+    return view;
+}
+
+// 按 view 的 stride 和通道顺序写成 g_a 的输入, view 已经过 resolve_view
+void view_to_planar(const ImageView& view, uint32_t pad_top, uint32_t pad_left, uint32_t y0, uint32_t x0, uint32_t th,
+                    uint32_t tw, float* out, ThreadPool* pool) {
+    rgb8_to_planar(view.data, view.stride, view.order == ChannelOrder::Bgr, view.height, view.width, pad_top,
+                   pad_left, y0, x0, th, tw, out, pool);
+}
+
+} // namespace
+
+
+uint32_t padded_size(uint32_t size, bool minimal_padding) {
+    // 64 对齐时两侧补相同的像素, 与之前的 pad4d 相同
+    return minimal_padding ? (size + 15) / 16 * 16 : size + 2 * pad_before(size);
+}
 
-    if (model_name != "bmshj2018-factorized" && model_name != "bmshj2018-factorized_relu") {
-        std::cout << "----------model_name: " << model_name << std::endl;
+
+Codec::Codec(const std::string& model_dir, const std::string& model_name, const std::string& metric_name,
+             char quality, const InferenceOptions& inference)
+    : model_dir_(model_dir), model_name_(model_name), metric_name_(metric_name), quality_(quality),
+      inference_(inference) {
+    if (!is_supported_model(model_name_)) {
+        std::cout << "----------model_name: " << model_name_ << std::endl;
         throw std::runtime_error("model is not supported");
     }
-  
-    uint32_t Scale = 16;
-    
-    xt::xarray<float> input_data_4d = ptr2xarray(params.rgb_data, original_width, original_height);
-    std::cout << "----------input_data_4d.shape: " << xt::adapt(input_data_4d.shape()) << std::endl;
+    if (inference_.tile_size % 16 != 0 || inference_.tile_overlap % 16 != 0) {
+        throw std::runtime_error("tile_size and tile_overlap must be multiples of 16");
+    }
+    if (inference_.max_batch == 0) {
+        throw std::runtime_error("max_batch must be positive");
+    }
+    if (!cpu_supports_precision(inference_.precision)) {
+        // 没有原生 16 位浮点指令时 ORT 只能逐层转换回 float32 计算, 比 FP32 模型还慢
+        std::cout << "----------cpu has no native fp16 / bf16 support, fall back to fp32 models" << std::endl;
+        inference_.precision = ModelPrecision::Fp32;
+    }
+    entropy_bottleneck_ = std::make_unique<EntropyBottleNeck>(model_path("entropy_bottleneck.npz"));
+    if (!inference_.warmup_shapes.empty()) {
+        warmup();
+    }
+}
 
-    xt::xarray<float> input_data_4d_pad = xt::eval(pad4d(input_data_4d, 64));
 
-    std::cout << "----------pad input_data_4d.shape: " << xt::adapt(input_data_4d_pad.shape()) << std::endl;
-    uint32_t after_pad_height = input_data_4d_pad.shape()[2];
-    uint32_t after_pad_width = input_data_4d_pad.shape()[3];
+Codec::~Codec() = default;
 
-    //load g_a
-    OnnxModelInferenceWrapper g_a(model_dir + "/" + model_name + "-" + metric_name + "-q" + quality + "-g_a.onnx", false);
-    uint32_t C = static_cast<uint32_t>(g_a.outputDims_[1]);
 
-    EntropyBottleNeck entropy_bottleneck_wrapper(model_dir + "/" + model_name + "-" + metric_name + "-q" + quality + "-entropy_bottleneck.npz");
+std::string Codec::model_path(const std::string& suffix) const {
+    return model_dir_ + "/" + model_name_ + "-" + metric_name_ + "-q" + std::to_string(quality_number(quality_)) +
+           "-" + suffix;
+}
 
-    // encode
-    // infer g_a
-    std::vector<int64_t> input_size = {1, 3, (int)after_pad_height, (int)after_pad_width};
-    int output_rows = after_pad_height / Scale;
-    int output_cols = after_pad_width / Scale;
-    std::vector<int64_t> output_size = {1, C, output_rows, output_cols};
 
-    auto start_time = std::chrono::high_resolution_clock::now();
+void Codec::check_params(const Params& params) const {
+    if (params.model_name != model_name_ || params.metric_name != metric_name_ ||
+        quality_number(params.quality) != quality_number(quality_)) {
+        throw std::runtime_error("params model " + params.model_name + "-" + params.metric_name + "-q" +
+                                 std::to_string(quality_number(params.quality)) + " does not match codec " +
+                                 model_path(""));
+    }
+}
 
-    std::vector<std::vector<float>> outputs = g_a.run(input_data_4d_pad, input_size, output_size);
 
-    std::vector<float> output_data_g_a = outputs[0];
-    // infer entropy_bottleneck.compress(y)
-    std::vector<size_t> output_shape{1, C, static_cast<size_t>(output_rows), static_cast<size_t>(output_cols)};
-    std::size_t total_output_size = static_cast<size_t>(1 * C * output_rows * output_cols);
-    auto output_data_g_a_xarray = xt::eval(xt::adapt(output_data_g_a.data(), 
-                                                        total_output_size, 
-                                                        xt::no_ownership(), output_shape));
+std::string Codec::network_path(const std::string& network) const {
+    switch (inference_.precision) {
+        case ModelPrecision::Int8:
+            return model_path(network + ".int8.onnx");
+        case ModelPrecision::Fp16:
+            return model_path(network + ".fp16.onnx");
+        case ModelPrecision::Bf16:
+            return model_path(network + ".bf16.onnx");
+        default:
+            return model_path(network + ".onnx");
+    }
+}
+
+
+ThreadPool& Codec::thread_pool() {
+    return shared_thread_pool();
+}
+
+
+OnnxModelInferenceWrapper& Codec::g_a() {
+    std::call_once(g_a_once_, [this]() {
+        g_a_ = std::make_unique<OnnxModelInferenceWrapper>(network_path("g_a"), inference_);
+    });
+    return *g_a_;
+}
+
+
+OnnxModelInferenceWrapper& Codec::g_s() {
+    std::call_once(g_s_once_, [this]() {
+        g_s_ = std::make_unique<OnnxModelInferenceWrapper>(network_path("g_s"), inference_);
+    });
+    return *g_s_;
+}
+
+
+void Codec::warmup() {
+    const uint32_t Scale = 16;
+    OnnxModelInferenceWrapper& g_a = this->g_a();
+    OnnxModelInferenceWrapper& g_s = this->g_s();
+    const int64_t C = g_a.outputDims_[1];
+
+    cache_aligned_vector<float> image;
+    cache_aligned_vector<float> latent;
+    for (const auto& shape : inference_.warmup_shapes) {
+        // 分块推理时实际运行的是块的尺寸
+        const uint32_t height = use_tiles(shape.first, shape.second)
+                                    ? std::min(shape.first, inference_.tile_size + 2 * inference_.tile_overlap)
+                                    : shape.first;
+        const uint32_t width = use_tiles(shape.first, shape.second)
+                                   ? std::min(shape.second, inference_.tile_size + 2 * inference_.tile_overlap)
+                                   : shape.second;
+        if (height % Scale != 0 || width % Scale != 0 || height == 0 || width == 0) {
+            throw std::runtime_error("warmup shape " + std::to_string(shape.first) + "x" +
+                                     std::to_string(shape.second) + " is not a positive multiple of 16");
+        }
+        const int64_t rows = height / Scale;
+        const int64_t cols = width / Scale;
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        image.assign(static_cast<size_t>(3) * height * width, 0.0f);
+        latent.assign(static_cast<size_t>(C) * rows * cols, 0.0f);
+        g_a.run(image.data(), {1, 3, height, width}, latent.data(), {1, C, rows, cols});
+        g_s.run(latent.data(), {1, C, rows, cols}, image.data(), {1, 3, height, width});
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        std::cout << "warmup " << height << "x" << width << " time taken: " << duration.count() << " milliseconds"
+                  << std::endl;
+    }
+}
+
+
+bool Codec::use_tiles(uint32_t height, uint32_t width) const {
+    return inference_.tile_size > 0 && (height > inference_.tile_size || width > inference_.tile_size);
+}
+
+
+void Codec::run_g_a_tiled(const ImageView& image, uint32_t pad_top, uint32_t pad_left, uint32_t rows, uint32_t cols,
+                          float* y) {
+    const uint32_t Scale = 16;
+    OnnxModelInferenceWrapper& g_a = this->g_a();
+    const int64_t C = g_a.outputDims_[1];
+
+    thread_local cache_aligned_vector<float> tile_input;
+    thread_local cache_aligned_vector<float> tile_output;
+    const auto row_ranges = tile_ranges(rows, inference_.tile_size / Scale, inference_.tile_overlap / Scale);
+    const auto col_ranges = tile_ranges(cols, inference_.tile_size / Scale, inference_.tile_overlap / Scale);
+    for (const TileRange& rr : row_ranges) {
+        for (const TileRange& cr : col_ranges) {
+            const uint32_t th = rr.margin_end - rr.margin_begin;
+            const uint32_t tw = cr.margin_end - cr.margin_begin;
+            tile_input.resize(static_cast<size_t>(3) * th * Scale * tw * Scale);
+            view_to_planar(image, pad_top, pad_left, rr.margin_begin * Scale, cr.margin_begin * Scale, th * Scale,
+                           tw * Scale, tile_input.data(), &thread_pool());
+
+            tile_output.resize(static_cast<size_t>(C) * th * tw);
+            g_a.run(tile_input.data(), {1, 3, th * Scale, tw * Scale}, tile_output.data(), {1, C, th, tw});
+
+            // 只保留块内部
+            for (int64_t c = 0; c < C; c++) {
+                for (uint32_t r = rr.begin; r < rr.end; r++) {
+                    const float* src = tile_output.data() + (static_cast<size_t>(c) * th + r - rr.margin_begin) * tw +
+                                       (cr.begin - cr.margin_begin);
+                    std::copy_n(src, cr.end - cr.begin, y + (static_cast<size_t>(c) * rows + r) * cols + cr.begin);
+                }
+            }
+        }
+    }
+}
+
+
+void Codec::run_g_s_tiled(const float* y, uint32_t rows, uint32_t cols, uint32_t top, uint32_t left,
+                          uint32_t original_height, uint32_t original_width, uint8_t* rgb, bool bgr) {
+    const uint32_t Scale = 16;
+    OnnxModelInferenceWrapper& g_s = this->g_s();
+    const int64_t C = g_s.inputDims_[1];
+
+    // 从 (top, left) 裁剪回原图尺寸
+    const uint32_t height = rows * Scale;
+    const uint32_t width = cols * Scale;
+    const uint32_t bottom = std::min(height, top + original_height);
+    const uint32_t right = std::min(width, left + original_width);
+
+    thread_local cache_aligned_vector<float> tile_input;
+    thread_local cache_aligned_vector<float> tile_output;
+    const auto row_ranges = tile_ranges(rows, inference_.tile_size / Scale, inference_.tile_overlap / Scale);
+    const auto col_ranges = tile_ranges(cols, inference_.tile_size / Scale, inference_.tile_overlap / Scale);
+    for (const TileRange& rr : row_ranges) {
+        for (const TileRange& cr : col_ranges) {
+            const uint32_t th = rr.margin_end - rr.margin_begin;
+            const uint32_t tw = cr.margin_end - cr.margin_begin;
+            tile_input.resize(static_cast<size_t>(C) * th * tw);
+            for (int64_t c = 0; c < C; c++) {
+                for (uint32_t r = 0; r < th; r++) {
+                    std::copy_n(y + (static_cast<size_t>(c) * rows + rr.margin_begin + r) * cols + cr.margin_begin, tw,
+                                tile_input.data() + (static_cast<size_t>(c) * th + r) * tw);
+                }
+            }
+
+            const size_t out_h = static_cast<size_t>(th) * Scale;
+            const size_t out_w = static_cast<size_t>(tw) * Scale;
+            tile_output.resize(3 * out_h * out_w);
+            g_s.run(tile_input.data(), {1, C, th, tw}, tile_output.data(),
+                    {1, 3, static_cast<int64_t>(out_h), static_cast<int64_t>(out_w)});
+
+            // 块内部与裁剪区域的交集写入 HWC 输出
+            const uint32_t y0 = std::max(rr.begin * Scale, top);
+            const uint32_t y1 = std::min(rr.end * Scale, bottom);
+            const uint32_t x0 = std::max(cr.begin * Scale, left);
+            const uint32_t x1 = std::min(cr.end * Scale, right);
+            if (y0 < y1 && x0 < x1) {
+                planar_to_rgb8(tile_output.data(), out_h, out_w, y0 - rr.margin_begin * Scale,
+                               y1 - rr.margin_begin * Scale, x0 - cr.margin_begin * Scale, x1 - cr.margin_begin * Scale,
+                               rgb + (static_cast<size_t>(y0 - top) * original_width + (x0 - left)) * 3,
+                               static_cast<size_t>(original_width) * 3, bgr, &thread_pool());
+            }
+        }
+    }
+}
+
+
+void Codec::encode_prepare(const Params& params, const ImageView& image, EncodeStage& stage) {
+    check_params(params);
+    stage.image = resolve_view(image);
+    if (stage.image.width != params.original_width || stage.image.height != params.original_height) {
+        throw std::runtime_error("image size does not match params.original_width / original_height");
+    }
+
+    const uint32_t Scale = 16;
+    const uint32_t original_height = params.original_height;
+    const uint32_t original_width = params.original_width;
+
+    const bool minimal_padding = params.coding.minimal_padding;
+    stage.pad_top = pad_before(original_height, minimal_padding);
+    stage.pad_left = pad_before(original_width, minimal_padding);
+    stage.padded_height = padded_size(original_height, minimal_padding);
+    stage.padded_width = padded_size(original_width, minimal_padding);
+    stage.rows = stage.padded_height / Scale;
+    stage.cols = stage.padded_width / Scale;
+
+    // 分块推理时每块在 run_g_a_tiled 中单独准备输入
+    if (use_tiles(stage.padded_height, stage.padded_width)) {
+        stage.input.clear();
+        return;
+    }
+    stage.input.resize(static_cast<size_t>(3) * stage.padded_height * stage.padded_width);
+    view_to_planar(stage.image, stage.pad_top, stage.pad_left, 0, 0, stage.padded_height, stage.padded_width,
+                   stage.input.data(), &thread_pool());
+}
+
+
+void Codec::encode_analysis(const Params& params, EncodeStage& stage) {
+    OnnxModelInferenceWrapper& g_a = this->g_a();
+    const int64_t C = g_a.outputDims_[1];
+
+    // g_a 直接写入 stage.y, 熵编码直接读取, 不经过中间拷贝
+    stage.y.resize(static_cast<size_t>(C) * stage.rows * stage.cols);
+    if (stage.input.empty()) {
+        run_g_a_tiled(stage.image, stage.pad_top, stage.pad_left, stage.rows, stage.cols, stage.y.data());
+    } else {
+        g_a.run(stage.input.data(), {1, 3, stage.padded_height, stage.padded_width}, stage.y.data(),
+                {1, C, stage.rows, stage.cols});
+    }
+}
 
-    std::vector<std::string> compressed_strings = entropy_bottleneck_wrapper.compress(output_data_g_a_xarray);
+
+void Codec::encode_entropy(Params& params, const EncodeStage& stage) {
+    const int C = static_cast<int>(stage.y.size() / (static_cast<size_t>(stage.rows) * stage.cols));
+
+    // infer entropy_bottleneck.compress(y)
+    std::vector<std::string> compressed_strings = entropy_bottleneck_->compress(
+        stage.y.data(), {1, C, static_cast<int>(stage.rows), static_cast<int>(stage.cols)}, params.coding);
 
     params.compressed_string = compressed_strings[0];
-    params.output_rows = output_rows;
-    params.output_cols = output_cols;
+    params.compressed_strings = compressed_strings;
+    params.output_rows = stage.rows;
+    params.output_cols = stage.cols;
+    params.pad_top = stage.pad_top;
+    params.pad_left = stage.pad_left;
+}
+
+
+void Codec::encode(Params& params) {
+    encode(params, packed_rgb_view(params));
+}
+
+
+void Codec::encode(Params& params, const ImageView& image) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    const ImageView view = resolve_view(image);
+    params.original_width = view.width;
+    params.original_height = view.height;
+
+    // 每个线程复用的缓冲
+    thread_local EncodeStage stage;
+    encode_prepare(params, view, stage);
+    encode_analysis(params, stage);
+    encode_entropy(params, stage);
+    // 不保留调用方的内存
+    stage.image = ImageView();
 
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
@@ -118,28 +428,38 @@ void encode_buffer(Params& params, const std::string& model_dir) {
 }
 
 
-void encode_file(const std::string& input_file, const std::string& output_file, Params& params, const std::string& model_dir) {
-    // bgr
-    cv::Mat input_image = cv::imread(input_file);
-    // rgb
-    cv::cvtColor(input_image, input_image, cv::COLOR_BGR2RGB);
-
-    std::shared_ptr<uint8_t> buffer(
-        reinterpret_cast<uint8_t*>(input_image.data),
-        [input_image](uint8_t*) mutable {
-            // capture input_image by copy to hold its memory
-            // do nothing on delete, because input_image manages memory
-        }
-    );
+void encode_buffer(Params& params, const std::string& model_dir) {
+    Codec codec(model_dir, params.model_name, params.metric_name, params.quality);
+    codec.encode(params);
+}
 
-    params.rgb_data = buffer;
-    params.original_height = input_image.rows;
-    params.original_width = input_image.cols;
 
-    encode_buffer(params, model_dir);
+void encode_buffer(Params& params, const ImageView& image, const std::string& model_dir) {
+    Codec codec(model_dir, params.model_name, params.metric_name, params.quality);
+    codec.encode(params, image);
+}
+
 
-    std::string compressed_string = params.compressed_string;
+void encode_file(const std::string& input_file, const std::string& output_file, Params& params, const std::string& model_dir,
+                 const InferenceOptions& inference) {
+    Codec codec(model_dir, params.model_name, params.metric_name, params.quality, inference);
+    encode_file(input_file, output_file, params, codec);
+}
+
+
+void encode_file(const std::string& input_file, const std::string& output_file, Params& params, Codec& codec) {
+    // bgr, 直接按 BGR 读取, 不转换成 RGB
+    cv::Mat input_image = cv::imread(input_file);
+    if (input_image.empty()) {
+        throw std::runtime_error("failed to read image " + input_file);
+    }
+
+    codec.encode(params, bgr_mat_view(input_image));
+    save_compressed(params, output_file);
+}
 
+
+void save_compressed(const Params& params, const std::string& output_file) {
     char code;
     build_code(metric_ids[params.metric_name], params.quality, code);
     char original_bitdepth = 8;
@@ -147,9 +467,12 @@ void encode_file(const std::string& input_file, const std::string& output_file,
     uint32_t original_width = params.original_width;
     uint32_t output_rows = params.output_rows;
     uint32_t output_cols = params.output_cols;
-    uint32_t n_strings = 1;
-    std::vector<uint32_t> length_strings = {static_cast<uint32_t>(compressed_string.size())};
-    std::vector<std::string> strings = {compressed_string};
+    std::vector<std::string> strings = params.compressed_strings;
+    uint32_t n_strings = strings.size();
+    std::vector<uint32_t> length_strings;
+    for (const auto& s : strings) {
+        length_strings.push_back(static_cast<uint32_t>(s.size()));
+    }
 
     fileInfo finfo = {
         output_file,
@@ -165,7 +488,10 @@ void encode_file(const std::string& input_file, const std::string& output_file,
         output_cols,
         n_strings,
         length_strings,
-        strings
+        strings,
+        params.coding,
+        params.pad_top,
+        params.pad_left
     };
 
     save(finfo, output_file);
@@ -173,19 +499,10 @@ void encode_file(const std::string& input_file, const std::string& output_file,
 }
 
 
-void decode_file(const std::string& compressed_file, const std::string& output_image_path, const std::string& model_dir) {
-    fileInfo finfo = load(compressed_file);
-    std::string model_name = finfo.model_name;
-    std::string metric_name = finfo.metric_name;
-    if (model_name != "bmshj2018-factorized" && model_name != "bmshj2018-factorized_relu") {
-        std::cout << "----------model_name: " << model_name << std::endl;
-        throw std::runtime_error("model is not supported");
-    }
-
-    std::string compressed_string = finfo.strings[0];
-    char quality = finfo.quality;
+static Params params_from_file(const fileInfo& finfo) {
+    std::string compressed_string = finfo.strings.empty() ? std::string() : finfo.strings[0];
 
-    Params params = {
+    return {
         finfo.quality,
         finfo.original_width,
         finfo.original_height,
@@ -195,48 +512,95 @@ void decode_file(const std::string& compressed_file, const std::string& output_i
         finfo.metric_name,
         nullptr,
         compressed_string,
+        finfo.coding,
+        finfo.strings,
+        finfo.pad_top,
+        finfo.pad_left,
     };
+}
+
 
-    decode_buffer(params, model_dir);
+static void decode_file(const fileInfo& finfo, const std::string& output_image_path, Codec& codec) {
+    Params params = params_from_file(finfo);
+
+    // imwrite 需要 BGR, 直接解码成 BGR8
+    codec.decode(params, ChannelOrder::Bgr);
     std::cout << "----------params.original_height: " << params.original_height << std::endl;
     std::cout << "----------params.original_width: " << params.original_width << std::endl;
 
     cv::Mat output_image_mat = cv::Mat(params.original_height, params.original_width, CV_8UC3, params.rgb_data.get());
-    cv::cvtColor(output_image_mat, output_image_mat, cv::COLOR_RGB2BGR);
     cv::imwrite(output_image_path, output_image_mat);
     std::cout << "Image saved to " << output_image_path << std::endl;
 }
 
+void decode_file(const std::string& compressed_file, const std::string& output_image_path, const std::string& model_dir,
+                 const InferenceOptions& inference) {
+    fileInfo finfo = load(compressed_file);
+    Codec codec(model_dir, finfo.model_name, finfo.metric_name, finfo.quality, inference);
+    decode_file(finfo, output_image_path, codec);
+}
+
+
+void decode_file(const std::string& compressed_file, const std::string& output_image_path, Codec& codec) {
+    decode_file(load(compressed_file), output_image_path, codec);
+}
+
+
+static void decode_file_region(const fileInfo& finfo, const std::string& output_image_path, uint32_t x, uint32_t y,
+                               uint32_t width, uint32_t height, Codec& codec) {
+    Params params = params_from_file(finfo);
+    codec.decode_region(params, x, y, width, height, ChannelOrder::Bgr);
+    cv::Mat output_image_mat = cv::Mat(height, width, CV_8UC3, params.rgb_data.get());
+    cv::imwrite(output_image_path, output_image_mat);
+    std::cout << "Region saved to " << output_image_path << std::endl;
+}
+
+void decode_file_region(const std::string& compressed_file, const std::string& output_image_path, uint32_t x,
+                        uint32_t y, uint32_t width, uint32_t height, const std::string& model_dir,
+                        const InferenceOptions& inference) {
+    fileInfo finfo = load(compressed_file);
+    Codec codec(model_dir, finfo.model_name, finfo.metric_name, finfo.quality, inference);
+    decode_file_region(finfo, output_image_path, x, y, width, height, codec);
+}
+
+
+void decode_file_region(const std::string& compressed_file, const std::string& output_image_path, uint32_t x,
+                        uint32_t y, uint32_t width, uint32_t height, Codec& codec) {
+    decode_file_region(load(compressed_file), output_image_path, x, y, width, height, codec);
+}
+
+
 void decode_buffer(Params& params, const std::string& model_dir) {
+    Codec codec(model_dir, params.model_name, params.metric_name, params.quality);
+    codec.decode(params);
+}
+
+
+void Codec::decode(Params& params, ChannelOrder order) {
     std::string compressed_string = params.compressed_string;
     uint32_t latent_rows = params.output_rows;
     uint32_t latent_cols = params.output_cols;
     uint32_t original_height = params.original_height;
     uint32_t original_width = params.original_width;
     uint32_t Scale = 16;
-    std::string model_name = params.model_name;
-    std::string metric_name = params.metric_name;
-    char quality = params.quality;
-
-    if (model_name != "bmshj2018-factorized" && model_name != "bmshj2018-factorized_relu") {
-        std::cout << "----------model_name: " << model_name << std::endl;
-        throw std::runtime_error("model is not supported");
-    }
-    
-    // load entropy_bottleneck
-    EntropyBottleNeck entropy_bottleneck_wrapper(model_dir + "/" + model_name + "-" + params.metric_name + "-q" + params.quality + "-entropy_bottleneck.npz");
+    check_params(params);
 
-    // load onnx runtime
-    OnnxModelInferenceWrapper g_s(model_dir + "/" + model_name + "-" + params.metric_name + "-q" + params.quality + "-g_s.onnx", false);
+    OnnxModelInferenceWrapper& g_s = this->g_s();
     uint32_t C = static_cast<uint32_t>(g_s.inputDims_[1]);
 
     auto start_time = std::chrono::high_resolution_clock::now();
     // decompress
-    std::vector<std::string> strings_list = {compressed_string};
+    std::vector<std::string> strings_list = params.compressed_strings;
+    if (strings_list.empty()) {
+        strings_list = {compressed_string};
+    }
     std::vector<int> input_shape = {latent_rows, latent_cols};
 
     auto start_time_decompress = std::chrono::high_resolution_clock::now();
-    xt::xarray<float> decompressed_data = entropy_bottleneck_wrapper.decompress(strings_list, input_shape);
+    // 熵解码直接写入 g_s 的输入缓冲 [1, C, H, W], 缓冲在每个线程中复用
+    thread_local cache_aligned_vector<float> decompressed_data;
+    decompressed_data.resize(static_cast<size_t>(C) * latent_rows * latent_cols);
+    entropy_bottleneck_->decompress(strings_list, input_shape, decompressed_data.data(), params.coding);
     auto end_time_decompress = std::chrono::high_resolution_clock::now();
     auto duration_decompress = std::chrono::duration_cast<std::chrono::milliseconds>(end_time_decompress - start_time_decompress);
     std::cout << "decompress time taken: " << duration_decompress.count() << " milliseconds" << std::endl;
@@ -244,38 +608,38 @@ void decode_buffer(Params& params, const std::string& model_dir) {
     // g_s
     uint32_t decompressed_data_height = latent_rows * Scale;
     uint32_t decompressed_data_width = latent_cols * Scale;
-    std::vector<std::vector<float>> outputs_data_g_s = g_s.run(decompressed_data, 
-                                                                {1, C, static_cast<int64_t>(latent_rows), static_cast<int64_t>(latent_cols)}, 
-                                                                {1, 3, static_cast<int64_t>(decompressed_data_height), static_cast<int64_t>(decompressed_data_width)});
-    auto start_time_decompress_post = std::chrono::high_resolution_clock::now();
-                                                                
-    std::vector<float> decompressed_data_float = outputs_data_g_s[0]; // N, C, H, W
-
-    // decompress image
-    std::vector<size_t> decompressed_data_shape{1, 3, static_cast<size_t>(decompressed_data_height), 
-                                                    static_cast<size_t>(decompressed_data_width)};
-    auto t = xt::adapt(decompressed_data_float.data(), decompressed_data_shape);
-    auto t_crop = crop4d(t, original_height, original_width);
-    auto decompressed_data_xarray = xt::eval(xt::view(t_crop, 0, xt::all(), xt::all(), xt::all()));
-    std::cout << "----------decompressed_data_xarray.shape: " << xt::adapt(decompressed_data_xarray.shape()) << std::endl;
-
-    //clamp_(0, 1)
-    auto clamped_scaled = xt::eval(xt::clip(decompressed_data_xarray, 0.0, 1.0) * 255.0);
-    std::cout << "----------clamped_scaled.shape: " << xt::adapt(clamped_scaled.shape()) << std::endl;
-    auto transposed = xt::transpose(clamped_scaled, {1, 2, 0});
-    std::cout << "----------transposed.shape: " << xt::adapt(transposed.shape()) << std::endl;
-    auto final_uint8 = xt::cast<uint8_t>(transposed);
-    auto final_uint8_eval = xt::eval(final_uint8);
-    std::cout << "----------final_uint8_eval.shape: " << xt::adapt(final_uint8_eval.shape()) << std::endl;
-
-    std::shared_ptr<uint8_t> buffer(
-        reinterpret_cast<uint8_t*>(final_uint8_eval.data()),
-        [final_uint8_eval](uint8_t*) mutable {
-            // capture xarr by copy to hold its memory
-            // do nothing on delete, because xarr manages memory
-        }
-    );
-    params.rgb_data = buffer;
+    std::chrono::high_resolution_clock::time_point start_time_decompress_post;
+    if (use_tiles(decompressed_data_height, decompressed_data_width)) {
+        // 分块推理直接写入最终的 HWC 图像, 不生成整图的 float 输出
+        std::shared_ptr<uint8_t> buffer(new uint8_t[static_cast<size_t>(original_height) * original_width * 3],
+                                        std::default_delete<uint8_t[]>());
+        uint32_t top, left;
+        crop_origin(params, decompressed_data_height, decompressed_data_width, top, left);
+        run_g_s_tiled(decompressed_data.data(), latent_rows, latent_cols, top, left, original_height, original_width,
+                      buffer.get(), order == ChannelOrder::Bgr);
+        start_time_decompress_post = std::chrono::high_resolution_clock::now();
+        params.rgb_data = buffer;
+    } else {
+        thread_local cache_aligned_vector<float> decompressed_data_float; // N, C, H, W
+        decompressed_data_float.resize(static_cast<size_t>(3) * decompressed_data_height * decompressed_data_width);
+        g_s.run(decompressed_data.data(),
+                {1, C, static_cast<int64_t>(latent_rows), static_cast<int64_t>(latent_cols)},
+                decompressed_data_float.data(),
+                {1, 3, static_cast<int64_t>(decompressed_data_height), static_cast<int64_t>(decompressed_data_width)});
+        start_time_decompress_post = std::chrono::high_resolution_clock::now();
+
+        // 裁剪, clamp_(0, 1) * 255, 转成 HWC 的 uint8, 一次写入输出缓冲
+        const uint32_t crop_h = std::min(decompressed_data_height, original_height);
+        const uint32_t crop_w = std::min(decompressed_data_width, original_width);
+        uint32_t top, left;
+        crop_origin(params, decompressed_data_height, decompressed_data_width, top, left);
+        std::shared_ptr<uint8_t> buffer(new uint8_t[static_cast<size_t>(crop_h) * crop_w * 3],
+                                        std::default_delete<uint8_t[]>());
+        planar_to_rgb8(decompressed_data_float.data(), decompressed_data_height, decompressed_data_width, top,
+                       top + crop_h, left, left + crop_w, buffer.get(), static_cast<size_t>(crop_w) * 3,
+                       order == ChannelOrder::Bgr, &thread_pool());
+        params.rgb_data = buffer;
+    }
 
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
@@ -287,6 +651,221 @@ void decode_buffer(Params& params, const std::string& model_dir) {
 }
 
 
+void Codec::encode_batch(std::vector<Params>& batch) {
+    const uint32_t Scale = 16;
+    OnnxModelInferenceWrapper& g_a = this->g_a();
+    const int64_t C = g_a.outputDims_[1];
+    const bool dynamic_batch = g_a.inputDims_[0] <= 0;
+
+    // 按填充后的尺寸分组
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<size_t>> groups;
+    for (size_t i = 0; i < batch.size(); i++) {
+        const Params& params = batch[i];
+        resolve_view(packed_rgb_view(params));
+        check_params(params);
+        groups[{padded_size(params.original_height, params.coding.minimal_padding),
+                padded_size(params.original_width, params.coding.minimal_padding)}].push_back(i);
+    }
+
+    thread_local cache_aligned_vector<float> input;
+    thread_local cache_aligned_vector<float> y;
+    for (const auto& group : groups) {
+        const uint32_t height = group.first.first;
+        const uint32_t width = group.first.second;
+        const std::vector<size_t>& indexes = group.second;
+        if (!dynamic_batch || use_tiles(height, width) || indexes.size() == 1) {
+            for (size_t i : indexes) {
+                encode(batch[i]);
+            }
+            continue;
+        }
+
+        const uint32_t rows = height / Scale;
+        const uint32_t cols = width / Scale;
+        const size_t input_size = static_cast<size_t>(3) * height * width;
+        const size_t latent_size = static_cast<size_t>(C) * rows * cols;
+        for (size_t first = 0; first < indexes.size(); first += inference_.max_batch) {
+            const size_t n = std::min<size_t>(inference_.max_batch, indexes.size() - first);
+            auto start_time = std::chrono::high_resolution_clock::now();
+
+            input.resize(n * input_size);
+            for (size_t j = 0; j < n; j++) {
+                const Params& params = batch[indexes[first + j]];
+                view_to_planar(resolve_view(packed_rgb_view(params)),
+                               pad_before(params.original_height, params.coding.minimal_padding),
+                               pad_before(params.original_width, params.coding.minimal_padding), 0, 0, height, width,
+                               input.data() + j * input_size, &thread_pool());
+            }
+
+            y.resize(n * latent_size);
+            const int64_t N = static_cast<int64_t>(n);
+            g_a.run(input.data(), {N, 3, height, width}, y.data(), {N, C, rows, cols});
+
+            for (size_t j = 0; j < n; j++) {
+                Params& params = batch[indexes[first + j]];
+                params.compressed_strings = entropy_bottleneck_->compress(
+                    y.data() + j * latent_size, {1, static_cast<int>(C), static_cast<int>(rows), static_cast<int>(cols)},
+                    params.coding);
+                params.compressed_string = params.compressed_strings[0];
+                params.output_rows = rows;
+                params.output_cols = cols;
+                params.pad_top = pad_before(params.original_height, params.coding.minimal_padding);
+                params.pad_left = pad_before(params.original_width, params.coding.minimal_padding);
+            }
+
+            auto end_time = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+            std::cout << "encode batch of " << n << " time taken: " << duration.count() << " milliseconds" << std::endl;
+        }
+    }
+}
+
+
+void Codec::decode_region(Params& params, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                          ChannelOrder order) {
+    const uint32_t Scale = 16;
+    check_params(params);
+    if (width == 0 || height == 0 || x > params.original_width || width > params.original_width - x ||
+        y > params.original_height || height > params.original_height - y) {
+        throw std::runtime_error("region is outside the image");
+    }
+    if (params.coding.spatial_tile == 0) {
+        throw std::runtime_error("region decode needs a stream encoded with --spatial-tile");
+    }
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    OnnxModelInferenceWrapper& g_s = this->g_s();
+    const uint32_t C = static_cast<uint32_t>(g_s.inputDims_[1]);
+    const uint32_t rows = params.output_rows;
+    const uint32_t cols = params.output_cols;
+    uint32_t top, left;
+    crop_origin(params, rows * Scale, cols * Scale, top, left);
+    // 区域在 g_s 输出中的范围
+    const uint32_t y0 = top + y;
+    const uint32_t x0 = left + x;
+    if (y0 + height > rows * Scale || x0 + width > cols * Scale) {
+        throw std::runtime_error("region is outside the decoded image");
+    }
+
+    // 覆盖区域的潜变量再向外扩展 tile_overlap, 与分块推理相同
+    const uint32_t margin = inference_.tile_overlap / Scale;
+    const uint32_t row_begin = y0 / Scale > margin ? y0 / Scale - margin : 0;
+    const uint32_t row_end = std::min(rows, (y0 + height + Scale - 1) / Scale + margin);
+    const uint32_t col_begin = x0 / Scale > margin ? x0 / Scale - margin : 0;
+    const uint32_t col_end = std::min(cols, (x0 + width + Scale - 1) / Scale + margin);
+    const uint32_t window_rows = row_end - row_begin;
+    const uint32_t window_cols = col_end - col_begin;
+
+    std::vector<std::string> strings_list = params.compressed_strings;
+    if (strings_list.empty()) {
+        strings_list = {params.compressed_string};
+    }
+    thread_local cache_aligned_vector<float> latent;
+    latent.resize(static_cast<size_t>(C) * window_rows * window_cols);
+    entropy_bottleneck_->decompress_region(strings_list, {static_cast<int>(rows), static_cast<int>(cols)},
+                                           static_cast<int>(row_begin), static_cast<int>(row_end),
+                                           static_cast<int>(col_begin), static_cast<int>(col_end), latent.data(),
+                                           params.coding);
+
+    // 区域在窗口的 g_s 输出中的左上角
+    const uint32_t region_top = y0 - row_begin * Scale;
+    const uint32_t region_left = x0 - col_begin * Scale;
+    std::shared_ptr<uint8_t> buffer(new uint8_t[static_cast<size_t>(height) * width * 3],
+                                    std::default_delete<uint8_t[]>());
+    if (use_tiles(window_rows * Scale, window_cols * Scale)) {
+        run_g_s_tiled(latent.data(), window_rows, window_cols, region_top, region_left, height, width, buffer.get(),
+                      order == ChannelOrder::Bgr);
+    } else {
+        const size_t out_h = static_cast<size_t>(window_rows) * Scale;
+        const size_t out_w = static_cast<size_t>(window_cols) * Scale;
+        thread_local cache_aligned_vector<float> output;
+        output.resize(3 * out_h * out_w);
+        g_s.run(latent.data(), {1, C, window_rows, window_cols}, output.data(),
+                {1, 3, static_cast<int64_t>(out_h), static_cast<int64_t>(out_w)});
+        planar_to_rgb8(output.data(), out_h, out_w, region_top, region_top + height, region_left,
+                       region_left + width, buffer.get(), static_cast<size_t>(width) * 3, order == ChannelOrder::Bgr,
+                       &thread_pool());
+    }
+    params.rgb_data = buffer;
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    std::cout << "decode region " << width << "x" << height << " (latent " << window_cols << "x" << window_rows
+              << " of " << cols << "x" << rows << ") time taken: " << duration.count() << " milliseconds"
+              << std::endl;
+}
+
+
+void Codec::decode_batch(std::vector<Params>& batch) {
+    const uint32_t Scale = 16;
+    OnnxModelInferenceWrapper& g_s = this->g_s();
+    const int64_t C = g_s.inputDims_[1];
+    const bool dynamic_batch = g_s.inputDims_[0] <= 0;
+
+    // 按潜变量尺寸分组
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<size_t>> groups;
+    for (size_t i = 0; i < batch.size(); i++) {
+        check_params(batch[i]);
+        groups[{batch[i].output_rows, batch[i].output_cols}].push_back(i);
+    }
+
+    thread_local cache_aligned_vector<float> latent;
+    thread_local cache_aligned_vector<float> output;
+    for (const auto& group : groups) {
+        const uint32_t rows = group.first.first;
+        const uint32_t cols = group.first.second;
+        const uint32_t height = rows * Scale;
+        const uint32_t width = cols * Scale;
+        const std::vector<size_t>& indexes = group.second;
+        if (!dynamic_batch || use_tiles(height, width) || indexes.size() == 1) {
+            for (size_t i : indexes) {
+                decode(batch[i]);
+            }
+            continue;
+        }
+
+        const size_t latent_size = static_cast<size_t>(C) * rows * cols;
+        const size_t output_size = static_cast<size_t>(3) * height * width;
+        for (size_t first = 0; first < indexes.size(); first += inference_.max_batch) {
+            const size_t n = std::min<size_t>(inference_.max_batch, indexes.size() - first);
+            auto start_time = std::chrono::high_resolution_clock::now();
+
+            latent.resize(n * latent_size);
+            for (size_t j = 0; j < n; j++) {
+                const Params& params = batch[indexes[first + j]];
+                const std::vector<std::string> strings_list =
+                    params.compressed_strings.empty() ? std::vector<std::string>{params.compressed_string}
+                                                      : params.compressed_strings;
+                entropy_bottleneck_->decompress(strings_list, {static_cast<int>(rows), static_cast<int>(cols)},
+                                                latent.data() + j * latent_size, params.coding);
+            }
+
+            output.resize(n * output_size);
+            const int64_t N = static_cast<int64_t>(n);
+            g_s.run(latent.data(), {N, C, rows, cols}, output.data(), {N, 3, height, width});
+
+            for (size_t j = 0; j < n; j++) {
+                Params& params = batch[indexes[first + j]];
+                // 裁剪回原图尺寸
+                const uint32_t crop_h = std::min(height, params.original_height);
+                const uint32_t crop_w = std::min(width, params.original_width);
+                uint32_t top, left;
+                crop_origin(params, height, width, top, left);
+                std::shared_ptr<uint8_t> buffer(new uint8_t[static_cast<size_t>(crop_h) * crop_w * 3],
+                                                std::default_delete<uint8_t[]>());
+                planar_to_rgb8(output.data() + j * output_size, height, width, top, top + crop_h, left,
+                               left + crop_w, buffer.get(), static_cast<size_t>(crop_w) * 3, false, &thread_pool());
+                params.rgb_data = buffer;
+            }
+
+            auto end_time = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+            std::cout << "decode batch of " << n << " time taken: " << duration.count() << " milliseconds" << std::endl;
+        }
+    }
+}
+
+
 void read_compressed_info(const std::string& compressed_file) {
     fileInfo finfo = load(compressed_file);
     std::cout << "model_name: " << finfo.model_name << std::endl;
@@ -297,9 +876,160 @@ void read_compressed_info(const std::string& compressed_file) {
     std::cout << "output_rows: " << finfo.output_rows << std::endl;
     std::cout << "output_cols: " << finfo.output_cols << std::endl;
     std::cout << "n_strings: " << finfo.n_strings << std::endl;
+    std::cout << "rans_interleave: " << static_cast<int>(finfo.coding.rans_interleave) << std::endl;
+    std::cout << "entropy_coder: " << static_cast<int>(finfo.coding.entropy_coder) << std::endl;
+    std::cout << "n_substreams: " << static_cast<int>(finfo.coding.n_substreams) << std::endl;
+    std::cout << "rans_chunk_symbols: " << finfo.coding.rans_chunk_symbols << std::endl;
+    std::cout << "skip_constant_channels: " << finfo.coding.skip_constant_channels << std::endl;
+    std::cout << "minimal_padding: " << finfo.coding.minimal_padding << std::endl;
+    std::cout << "pad_top: " << finfo.pad_top << " pad_left: " << finfo.pad_left << std::endl;
+    std::cout << "spatial_tile: " << finfo.coding.spatial_tile << std::endl;
     std::cout << "length_strings: [";
     for (int i = 0; i < finfo.n_strings; i++) {
         std::cout << finfo.length_strings[i] << ", ";
     }
     std::cout << "]" << std::endl;
-}
\ No newline at end of file
+}
+
+
+EvalResult evaluate_file(const std::string& image_path, Codec& codec, const CodingOptions& coding, int repeat) {
+    cv::Mat image = cv::imread(image_path);
+    if (image.empty()) {
+        throw std::runtime_error("failed to read image " + image_path);
+    }
+    // 按 BGR 编码和解码, 与原图直接比较
+    const ImageView view = bgr_mat_view(image);
+
+    EvalResult result = {0.0, 0.0, 0.0, 0.0, static_cast<uint32_t>(image.rows), static_cast<uint32_t>(image.cols)};
+    for (int i = 0; i <= std::max(repeat, 1); i++) {
+        Params params = {
+            codec.quality(),
+            static_cast<uint32_t>(image.cols),
+            static_cast<uint32_t>(image.rows),
+            0,
+            0,
+            codec.model_name(),
+            codec.metric_name(),
+            nullptr,
+            "",
+            coding,
+        };
+        auto t0 = std::chrono::high_resolution_clock::now();
+        codec.encode(params, view);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        codec.decode(params, ChannelOrder::Bgr);
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        const double encode_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        const double decode_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        // 第 0 次包含模型加载
+        if (i == 1 || (i > 1 && encode_ms < result.encode_ms)) {
+            result.encode_ms = encode_ms;
+        }
+        if (i == 1 || (i > 1 && decode_ms < result.decode_ms)) {
+            result.decode_ms = decode_ms;
+        }
+        if (i > 0) {
+            continue;
+        }
+
+        size_t n_bytes = 0;
+        for (const auto& s : params.compressed_strings) {
+            n_bytes += s.size();
+        }
+        const size_t n_pixels = static_cast<size_t>(image.rows) * image.cols;
+        result.bpp = n_bytes * 8.0 / n_pixels;
+
+        double sse = 0.0;
+        const uint8_t* decoded = params.rgb_data.get();
+        for (int r = 0; r < image.rows; r++) {
+            const uint8_t* original = image.ptr<uint8_t>(r);
+            for (int x = 0; x < image.cols * 3; x++) {
+                const double d = static_cast<double>(original[x]) - decoded[static_cast<size_t>(r) * image.cols * 3 + x];
+                sse += d * d;
+            }
+        }
+        const double mse = sse / (n_pixels * 3);
+        result.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+    }
+    return result;
+}
+
+
+std::vector<ProviderBenchmark> Codec::benchmark_providers(const std::string& image_path,
+                                                          const std::vector<ExecutionProvider>& providers, int repeat) {
+    cv::Mat image = cv::imread(image_path);
+    if (image.empty()) {
+        throw std::runtime_error("failed to read image " + image_path);
+    }
+
+    const uint32_t Scale = 16;
+    const uint32_t height = image.rows;
+    const uint32_t width = image.cols;
+    const uint32_t pad_top = pad_before(height);
+    const uint32_t pad_left = pad_before(width);
+    const int64_t padded_height = height + 2 * pad_top;
+    const int64_t padded_width = width + 2 * pad_left;
+    const int64_t rows = padded_height / Scale;
+    const int64_t cols = padded_width / Scale;
+
+    cache_aligned_vector<float> input(static_cast<size_t>(3) * padded_height * padded_width);
+    view_to_planar(resolve_view(bgr_mat_view(image)), pad_top, pad_left, 0, 0, padded_height, padded_width,
+                   input.data(), &thread_pool());
+    cache_aligned_vector<float> y;
+    cache_aligned_vector<float> y_hat;
+    cache_aligned_vector<float> x_hat(input.size());
+    cache_aligned_vector<float> reference;
+
+    std::vector<ProviderBenchmark> results;
+    for (ExecutionProvider provider : providers) {
+        InferenceOptions options = inference_;
+        options.provider = provider;
+        options.optimized_model_cache_dir.clear();
+        ProviderBenchmark result = {provider, provider, 0.0, 0.0, 0.0, 0.0};
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        OnnxModelInferenceWrapper g_a(network_path("g_a"), options);
+        OnnxModelInferenceWrapper g_s(network_path("g_s"), options);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        result.load_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        result.used = g_a.provider();
+
+        const int64_t C = g_a.outputDims_[1];
+        const std::vector<int64_t> input_dims = {1, 3, padded_height, padded_width};
+        const std::vector<int64_t> latent_dims = {1, C, rows, cols};
+        y.resize(static_cast<size_t>(C) * rows * cols);
+        for (int i = 0; i <= std::max(repeat, 1); i++) {
+            auto a0 = std::chrono::high_resolution_clock::now();
+            g_a.run(input.data(), input_dims, y.data(), latent_dims);
+            auto a1 = std::chrono::high_resolution_clock::now();
+            // 所有后端的 g_s 使用相同的输入: 第一个后端 g_a 输出取整
+            if (y_hat.empty()) {
+                y_hat.resize(y.size());
+                std::transform(y.begin(), y.end(), y_hat.begin(), [](float v) { return std::round(v); });
+            }
+            g_s.run(y_hat.data(), latent_dims, x_hat.data(), input_dims);
+            auto a2 = std::chrono::high_resolution_clock::now();
+
+            // 第 0 次为预热
+            const double g_a_ms = std::chrono::duration<double, std::milli>(a1 - a0).count();
+            const double g_s_ms = std::chrono::duration<double, std::milli>(a2 - a1).count();
+            if (i == 1 || (i > 1 && g_a_ms < result.g_a_ms)) {
+                result.g_a_ms = g_a_ms;
+            }
+            if (i == 1 || (i > 1 && g_s_ms < result.g_s_ms)) {
+                result.g_s_ms = g_s_ms;
+            }
+        }
+
+        if (reference.empty()) {
+            reference = x_hat;
+        } else {
+            for (size_t i = 0; i < x_hat.size(); i++) {
+                result.max_abs_diff = std::max(result.max_abs_diff, static_cast<double>(std::abs(x_hat[i] - reference[i])));
+            }
+        }
+        results.push_back(result);
+    }
+    return results;
+}
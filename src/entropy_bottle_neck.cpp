@@ -4,14 +4,17 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <algorithm>
 #include <map>
 #include <stdexcept>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 
 #include "entropy_bottleneck.h"
+#include "inference_options.h"
 #include "onnx_model_wrapper.h"
 #include "rans_interface.hpp"
+#include "verbose.h"
 
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -29,151 +32,463 @@ EntropyBottleNeck::EntropyBottleNeck(const std::string& npz_path){
 
     std::vector<int> v =  npy_quantized_cdf.as_vec<int>();
 
-    for (int i = 0; i < C; ++i) {
-        int* ptr = v.data() + i * bins;
-        quantized_cdf_.push_back(std::vector<int>(ptr, ptr + bins));
-    }
-
     cnpy::NpyArray npy_cdf_length = data["_cdf_length"];
     cnpy::NpyArray npy_offset = data["_offset"];
     cnpy::NpyArray npy_quantiles = data["quantiles"];
 
-    cdf_length_ = npy_cdf_length.as_vec<int>();
-    offset_ = npy_offset.as_vec<int>();
-    quantiles_ = npy_quantiles.as_vec<float>();
-
-    std::cout << "quantized_cdf.shape: " << quantized_cdf_.size() << std::endl;
-    std::cout << "cdf_length.shape: " << cdf_length_.size() << std::endl;
-    std::cout << "offset.shape: " << offset_.size() << std::endl;
-    std::cout << "quantiles.shape: " << quantiles_.size() << std::endl;
-}
+    std::vector<int> cdf_length = npy_cdf_length.as_vec<int>();
+    std::vector<int> offset = npy_offset.as_vec<int>();
+    std::vector<float> quantiles = npy_quantiles.as_vec<float>();
+    if (static_cast<int>(cdf_length.size()) != C || static_cast<int>(offset.size()) != C ||
+        static_cast<int>(quantiles.size()) != C * 3) {
+        throw std::runtime_error("npz_path " + npz_path + " has inconsistent cdf shapes");
+    }
 
+    // 编解码用的表只在加载时构建一次, 直接使用 npz 中 [C, bins] 的连续数组
+    cdf_table_ = RansCdfTable(v.data(), bins, cdf_length, offset);
 
-std::vector<std::string> EntropyBottleNeck::compress(const xt::xarray<float>& input) {
-    // dummy input_shape
-    std::cout << "input.shape: " << xt::adapt(input.shape()) << std::endl;
+    // quantiles 的形状为 [C, 1, 3], 中位数为第 1 个
+    medians_.resize(C);
+    for (int c = 0; c < C; c++) {
+        medians_[c] = quantiles[c * 3 + 1];
+    }
 
-    int N = input.shape()[0];
-    int C = input.shape()[1];
-    int H = input.shape()[2];
-    int W = input.shape()[3];
+    if (verbose()) {
+        std::cout << "quantized_cdf.shape: [" << C << ", " << bins << "]" << std::endl;
+        std::cout << "cdf_length.shape: " << cdf_length.size() << std::endl;
+        std::cout << "offset.shape: " << offset.size() << std::endl;
+        std::cout << "quantiles.shape: " << quantiles.size() << std::endl;
+    }
+}
 
 
-    // adapt vector
-    std::vector<size_t> q_shape{static_cast<size_t>(C), 1, 3};
-    xt::xarray<float> quantiles_xarray = xt::adapt(quantiles_, q_shape);
-    std::cout << "quantiles_xarray.shape: " << xt::adapt(quantiles_xarray.shape()) << std::endl;
-    std::cout << "quantiles_xarray.mean: " << xt::mean(quantiles_xarray) << std::endl;
-    std::cout << " ---------------------------- " << std::endl;
+namespace {
 
-    xt::xarray<int> index_xarray = xt::zeros<int>({N, C, H, W});
-    xt::xarray<float> medians_xarray = xt::zeros<float>({N, C, 1, 1});
-    xt::xarray<int> symbol_xarray = xt::zeros<int>({N, C, H, W});
+// 与 static_cast<int>(std::round(x)) 结果相同 (0.5 远离 0 舍入)
+// 截断转换 + 比较可以向量化, std::round / std::trunc 在默认浮点选项下不行
+inline int32_t round_half_away(float x) {
+    const int32_t t = static_cast<int32_t>(x);
+    const float frac = x - static_cast<float>(t);
+    return t + (frac >= 0.5f) - (frac <= -0.5f);
+}
 
+// symbols[i] = round(y[i] - median), 一个通道
+void quantize_plane(const float* y, float median, size_t size, int32_t* symbols) {
+    for (size_t i = 0; i < size; i++) {
+        symbols[i] = round_half_away(y[i] - median);
+    }
+}
 
-    for(int in = 0; in < N; in++) {
-        for(int ic = 0; ic < C; ic++) {
-            for(int ih = 0; ih < H; ih++) {
-                for(int iw = 0; iw < W; iw++) {
-                    index_xarray.at(in, ic, ih, iw) = ic;
-                    float q_value = quantiles_xarray.at(ic, 0, 1);
-                    medians_xarray.at(in, ic, 0, 0) = q_value;
+// 常数通道的子码流头: [通道标志位图, 每通道 1 位][每个常数通道的取值, zigzag varint]
+// 后面还有 rANS 码流时, encode_substream 再把头补齐到 4 字节
+// skip[c] 置为 1 表示通道 c 为常数, 不进入 rANS 码流
+std::string encode_constant_channels(const int32_t* symbols, int n_channels, size_t plane, uint8_t* skip) {
+    std::string header((n_channels + 7) / 8, '\0');
+    for (int c = 0; c < n_channels; c++) {
+        const int32_t* s = symbols + c * plane;
+        const int32_t value = plane > 0 ? s[0] : 0;
+        bool constant = plane > 0;
+        for (size_t i = 1; i < plane; i++) {
+            constant &= s[i] == value;
+        }
+        skip[c] = constant;
+        if (!constant) {
+            continue;
+        }
+        header[c / 8] = static_cast<char>(header[c / 8] | (1 << (c % 8)));
+        uint32_t zigzag = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+        while (zigzag >= 0x80) {
+            header.push_back(static_cast<char>((zigzag & 0x7f) | 0x80));
+            zigzag >>= 7;
+        }
+        header.push_back(static_cast<char>(zigzag));
+    }
+    return header;
+}
 
-                    float input_value = input.at(in, ic, ih, iw);
-                    symbol_xarray.at(in, ic, ih, iw) = static_cast<int>(std::round(input_value - q_value));
-                }
+// 解析 encode_constant_channels 的头, 常数通道直接写入 value + median, 返回头的字节数
+size_t decode_constant_channels(const std::string& encoded, int n_channels, size_t plane, const float* medians,
+                                float* output, uint8_t* skip) {
+    size_t pos = (n_channels + 7) / 8;
+    if (encoded.size() < pos) {
+        throw std::runtime_error("truncated constant channel bitmap");
+    }
+    for (int c = 0; c < n_channels; c++) {
+        skip[c] = (static_cast<uint8_t>(encoded[c / 8]) >> (c % 8)) & 1;
+        if (!skip[c]) {
+            continue;
+        }
+        uint32_t zigzag = 0;
+        for (int shift = 0;; shift += 7) {
+            if (pos >= encoded.size() || shift > 28) {
+                throw std::runtime_error("truncated constant channel value");
+            }
+            const uint8_t byte = static_cast<uint8_t>(encoded[pos++]);
+            zigzag |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                break;
             }
         }
+        const int32_t value = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+        std::fill_n(output + c * plane, plane, static_cast<float>(value) + medians[c]);
     }
+    return pos;
+}
 
-    std::cout << "index.shape: " << xt::adapt(index_xarray.shape()) << std::endl;
-    std::cout << "medians.shape: " << xt::adapt(medians_xarray.shape()) << std::endl;
-    std::cout << "symbol.shape: " << xt::adapt(symbol_xarray.shape()) << std::endl;
-    
-    // encode
-    std::vector<std::string> strings_list;
-    for (int ni = 0; ni < N; ni++) {
-        xt::xarray<int> symbol_ni = xt::view(symbol_xarray, xt::range(ni, ni+1), xt::all(), xt::all(), xt::all());
-        xt::xarray<int> index_ni = xt::view(index_xarray, xt::range(ni, ni+1), xt::all(), xt::all(), xt::all());
+// 潜变量的一个空间块 [row_begin, row_end) x [col_begin, col_end)
+struct LatentTile {
+    int row_begin;
+    int row_end;
+    int col_begin;
+    int col_end;
+
+    size_t area() const { return static_cast<size_t>(row_end - row_begin) * (col_end - col_begin); }
+};
+
+// H x W 的潜变量按 tile x tile 行优先分块, tile 为 0 时只有覆盖整个潜变量的一块
+std::vector<LatentTile> latent_tiles(int H, int W, int tile) {
+    const int tile_rows = tile > 0 ? tile : std::max(H, 1);
+    const int tile_cols = tile > 0 ? tile : std::max(W, 1);
+    std::vector<LatentTile> tiles;
+    for (int r = 0; r < H; r += tile_rows) {
+        for (int c = 0; c < W; c += tile_cols) {
+            tiles.push_back({r, std::min(H, r + tile_rows), c, std::min(W, c + tile_cols)});
+        }
+    }
+    return tiles;
+}
+
+// 量化一个通道 (H x W 的 y) 在 tile 内的部分, 写成连续的 symbols
+void quantize_tile(const float* y, int W, const LatentTile& tile, float median, int32_t* symbols) {
+    const int tw = tile.col_end - tile.col_begin;
+    if (tw == W) {
+        quantize_plane(y + static_cast<size_t>(tile.row_begin) * W, median, tile.area(), symbols);
+        return;
+    }
+    for (int r = tile.row_begin; r < tile.row_end; r++) {
+        quantize_plane(y + static_cast<size_t>(r) * W + tile.col_begin, median, tw,
+                       symbols + static_cast<size_t>(r - tile.row_begin) * tw);
+    }
+}
 
-        std::cout << "symbol_ni.shape: " << xt::adapt(symbol_ni.shape()) << std::endl;
-        std::cout << "index_ni.shape: " << xt::adapt(index_ni.shape()) << std::endl;
+} // namespace
 
-        std::vector<int> symbol_vec(symbol_ni.begin(), symbol_ni.end());
-        std::vector<int> index_vec(index_ni.begin(), index_ni.end());
 
-        std::string strings = rans_enc.encode_with_indexes(symbol_vec, 
-                                                        index_vec, 
-                                                        quantized_cdf_, 
-                                                        cdf_length_, 
-                                                        offset_);
+std::vector<std::string> EntropyBottleNeck::compress(const xt::xarray<float>& input, const CodingOptions& coding) {
+    if (input.dimension() != 4) {
+        throw std::runtime_error("input must be NCHW");
+    }
+    std::vector<int> input_shape(input.shape().begin(), input.shape().end());
+    return compress(input.data(), input_shape, coding);
+}
+
 
-        std::cout << "strings.size: " << strings.size() << std::endl;
-        strings_list.push_back(strings);
+std::vector<std::string> EntropyBottleNeck::compress(const float* input, const std::vector<int>& input_shape,
+                                                     const CodingOptions& coding) {
+    if (verbose()) {
+        std::cout << "input.shape: " << xt::adapt(input_shape) << std::endl;
+    }
+
+    int N = input_shape[0];
+    int C = input_shape[1];
+    int H = input_shape[2];
+    int W = input_shape[3];
+    if (C != static_cast<int>(cdf_table_.size())) {
+        throw std::runtime_error("input has " + std::to_string(C) + " channels, the entropy model " +
+                                 std::to_string(cdf_table_.size()));
+    }
+
+    // encode
+    // 每个 batch 的每个空间块按通道分成 K 组, 每组一个独立子码流, strings_list 按 [(ni * n_tiles + t) * K + k] 排列
+    const int K = coding.n_substreams;
+    if (K < 1 || K > C) {
+        throw std::runtime_error("n_substreams must be in [1, " + std::to_string(C) + "], got " + std::to_string(K));
+    }
+    const size_t plane = static_cast<size_t>(H) * W;
+    const std::vector<LatentTile> tiles = latent_tiles(H, W, coding.spatial_tile);
+    const size_t n_tasks = tiles.size() * K;
+
+    // 量化和编码在同一个任务中完成, 符号的 cdf 索引就是通道号, 不需要索引数组
+    std::vector<std::string> strings_list(static_cast<size_t>(N) * n_tasks);
+    for (int ni = 0; ni < N; ni++) {
+        const float* y = input + static_cast<size_t>(ni) * C * plane;
+
+        thread_pool().parallel_for(n_tasks, [&](size_t task) {
+            const LatentTile& tile = tiles[task / K];
+            const size_t k = task % K;
+            const int c_begin = static_cast<int>(k * C / K);
+            const int c_end = static_cast<int>((k + 1) * C / K);
+            const size_t area = tile.area();
+            // 这个任务的通道组在块内的符号, 每个线程复用同一个缓冲
+            thread_local std::vector<int32_t> symbols;
+            symbols.resize((c_end - c_begin) * area);
+            for (int c = c_begin; c < c_end; c++) {
+                quantize_tile(y + c * plane, W, tile, medians_[c], symbols.data() + (c - c_begin) * area);
+            }
+            strings_list[ni * n_tasks + task] = encode_substream(symbols.data(), c_begin, c_end - c_begin, area,
+                                                                 coding);
+        });
+
+        if (!verbose()) {
+            continue;
+        }
+        if (tiles.size() == 1) {
+            for (int k = 0; k < K; k++) {
+                std::cout << "strings[" << k << "].size: " << strings_list[ni * K + k].size() << std::endl;
+            }
+        } else {
+            size_t n_bytes = 0;
+            for (size_t i = 0; i < n_tasks; i++) {
+                n_bytes += strings_list[ni * n_tasks + i].size();
+            }
+            std::cout << "tiles: " << tiles.size() << " strings: " << n_tasks << " bytes: " << n_bytes << std::endl;
+        }
     }
 
     return strings_list;
 
 }
 
-xt::xarray<float> EntropyBottleNeck::decompress(const std::vector<std::string>& strings_list, const std::vector<int>& input_shape) {
-    // dummy input_shape
-    std::cout << "strings_list.size: " << strings_list.size() << std::endl;
-    std::cout << "strings_list[0].size: " << strings_list[0].size() << std::endl;
+xt::xarray<float> EntropyBottleNeck::decompress(const std::vector<std::string>& strings_list, const std::vector<int>& input_shape,
+                                                const CodingOptions& coding) {
+    const size_t C = cdf_table_.size();
+    // 每张图像有 块数 * n_substreams 个子码流
+    const size_t n_tiles = latent_tiles(input_shape[0], input_shape[1], coding.spatial_tile).size();
+    const size_t N = strings_list.size() / std::max<size_t>(1, n_tiles * coding.n_substreams);
+    xt::xarray<float> output_xarray = xt::xarray<float>::from_shape(
+        {N, C, static_cast<size_t>(input_shape[0]), static_cast<size_t>(input_shape[1])});
+    decompress(strings_list, input_shape, output_xarray.data(), coding);
+    return output_xarray;
+}
+
+
+void EntropyBottleNeck::decompress(const std::vector<std::string>& strings_list, const std::vector<int>& input_shape,
+                                   float* output, const CodingOptions& coding) {
+    if (verbose()) {
+        std::cout << "strings_list.size: " << strings_list.size() << std::endl;
+    }
 
     int latent_rows = input_shape[0];
     int latent_cols = input_shape[1];
-    int C = quantized_cdf_.size();
-    int N = strings_list.size();
+    int C = cdf_table_.size();
+    const int K = coding.n_substreams;
     int H = latent_rows;
     int W = latent_cols;
+    const size_t n_tiles = latent_tiles(H, W, coding.spatial_tile).size();
+    if (K < 1 || K > C || strings_list.empty() || strings_list.size() % (n_tiles * K) != 0) {
+        throw std::runtime_error("strings_list.size " + std::to_string(strings_list.size()) +
+                                 " does not match n_substreams " + std::to_string(K) + " and " +
+                                 std::to_string(n_tiles) + " tiles");
+    }
+    int N = strings_list.size() / (n_tiles * K);
+    if (coding.spatial_tile > 0) {
+        // 每张图像解码全部块
+        for (int ni = 0; ni < N; ni++) {
+            decode_tiles(strings_list.data() + ni * n_tiles * K, H, W, 0, H, 0, W,
+                         output + static_cast<size_t>(ni) * C * H * W, coding);
+        }
+        return;
+    }
+
+    // decode
+    // 每个子码流直接写入自己通道的 float 输出 (symbol + median), 不经过中间数组
+    const size_t plane = static_cast<size_t>(H) * W;
+    for (int ni=0; ni<N; ni++) {
+        float* y_hat = output + static_cast<size_t>(ni) * C * plane;
+
+        thread_pool().parallel_for(K, [&](size_t k) {
+            const int c_begin = static_cast<int>(k * C / K);
+            const int c_end = static_cast<int>((k + 1) * C / K);
+            decode_substream(strings_list[ni * K + k], c_begin, c_end - c_begin, plane,
+                             y_hat + c_begin * plane, coding);
+        });
+    }
+}
+
+
+
+void EntropyBottleNeck::decompress_region(const std::vector<std::string>& strings_list,
+                                          const std::vector<int>& input_shape, int row_begin, int row_end,
+                                          int col_begin, int col_end, float* output, const CodingOptions& coding) {
+    const int H = input_shape[0];
+    const int W = input_shape[1];
+    if (coding.spatial_tile == 0) {
+        throw std::runtime_error("region decode needs a stream encoded with spatial_tile > 0");
+    }
+    if (row_begin < 0 || row_begin >= row_end || row_end > H || col_begin < 0 || col_begin >= col_end ||
+        col_end > W) {
+        throw std::runtime_error("region is outside the latent");
+    }
+    const size_t n_strings = latent_tiles(H, W, coding.spatial_tile).size() * coding.n_substreams;
+    if (strings_list.size() != n_strings) {
+        throw std::runtime_error("strings_list.size " + std::to_string(strings_list.size()) + " is not one image of " +
+                                 std::to_string(n_strings) + " strings");
+    }
+    decode_tiles(strings_list.data(), H, W, row_begin, row_end, col_begin, col_end, output, coding);
+}
+
+
+void EntropyBottleNeck::decode_tiles(const std::string* strings, int H, int W, int row_begin, int row_end,
+                                     int col_begin, int col_end, float* output, const CodingOptions& coding) {
+    const int C = cdf_table_.size();
+    const int K = coding.n_substreams;
+    const int rh = row_end - row_begin;
+    const int rw = col_end - col_begin;
+    const std::vector<LatentTile> all_tiles = latent_tiles(H, W, coding.spatial_tile);
+
+    // 与窗口相交的块在 strings 中的序号
+    std::vector<size_t> tiles;
+    for (size_t t = 0; t < all_tiles.size(); t++) {
+        const LatentTile& tile = all_tiles[t];
+        if (tile.row_begin < row_end && tile.row_end > row_begin && tile.col_begin < col_end &&
+            tile.col_end > col_begin) {
+            tiles.push_back(t);
+        }
+    }
 
-    std::vector<int> output_size{1, C, latent_rows, latent_cols};
+    thread_pool().parallel_for(tiles.size() * K, [&](size_t task) {
+        const size_t t = tiles[task / K];
+        const LatentTile& tile = all_tiles[t];
+        const size_t k = task % K;
+        const int c_begin = static_cast<int>(k * C / K);
+        const int c_end = static_cast<int>((k + 1) * C / K);
+        const size_t area = tile.area();
+        const int tw = tile.col_end - tile.col_begin;
+
+        // 块的这组通道解码到每个线程复用的缓冲, 再把与窗口的交集写入 output
+        thread_local std::vector<float> decoded;
+        decoded.resize((c_end - c_begin) * area);
+        decode_substream(strings[t * K + k], c_begin, c_end - c_begin, area, decoded.data(), coding);
+
+        const int r0 = std::max(tile.row_begin, row_begin);
+        const int r1 = std::min(tile.row_end, row_end);
+        const int x0 = std::max(tile.col_begin, col_begin);
+        const int x1 = std::min(tile.col_end, col_end);
+        for (int c = c_begin; c < c_end; c++) {
+            const float* src = decoded.data() + (c - c_begin) * area;
+            for (int r = r0; r < r1; r++) {
+                std::copy_n(src + static_cast<size_t>(r - tile.row_begin) * tw + (x0 - tile.col_begin), x1 - x0,
+                            output + (static_cast<size_t>(c) * rh + r - row_begin) * rw + (x0 - col_begin));
+            }
+        }
+    });
+}
 
-    std::vector<size_t> q_shape{static_cast<size_t>(C), 1, 3};
-    xt::xarray<float> quantiles_xarray = xt::adapt(quantiles_, q_shape);
 
-    xt::xarray<int> index_xarray = xt::zeros<int>({N, C, H, W});
-    xt::xarray<float> medians_xarray = xt::zeros<float>({N, C, 1, 1});
+std::string EntropyBottleNeck::encode_substream(const int32_t* symbols, int first_channel, int n_channels,
+                                                size_t plane, const CodingOptions& coding) {
+    std::string header;
+    std::vector<uint8_t> skip(n_channels, 0);
+    int n_coded = n_channels;
+    if (coding.skip_constant_channels) {
+        header = encode_constant_channels(symbols, n_channels, plane, skip.data());
+        n_coded -= std::count(skip.begin(), skip.end(), 1);
+        if (n_coded == 0) {
+            return header;
+        }
+        // 头补齐到 4 字节, 解码时可以直接按 32 位字读取后面的 rANS 码流
+        header.resize((header.size() + 3) & ~static_cast<size_t>(3), '\0');
+    }
 
-    for(int in = 0; in < N; in++) {
-        for(int ic = 0; ic < C; ic++) {
-            for(int ih = 0; ih < H; ih++) {
-                for(int iw = 0; iw < W; iw++) {
-                    index_xarray.at(in, ic, ih, iw) = ic;
-                    float q_value = quantiles_xarray.at(ic, 0, 1);
-                    medians_xarray.at(in, ic, 0, 0) = q_value;
-                }
+    if (coding.entropy_coder == EntropyCoder::RansSimd || coding.rans_chunk_symbols > 0) {
+        // 这两种编码器需要逐符号的索引
+        std::vector<int32_t> symbol_vec;
+        std::vector<int32_t> index_vec;
+        symbol_vec.reserve(n_coded * plane);
+        index_vec.reserve(n_coded * plane);
+        for (int c = 0; c < n_channels; c++) {
+            if (skip[c]) {
+                continue;
             }
+            symbol_vec.insert(symbol_vec.end(), symbols + c * plane, symbols + (c + 1) * plane);
+            index_vec.insert(index_vec.end(), plane, first_channel + c);
         }
+        if (coding.entropy_coder == EntropyCoder::RansSimd) {
+            RansSimdEncoder encoder;
+            return header + encoder.encode_with_indexes(symbol_vec, index_vec, simd_table());
+        }
+        ChunkedRansEncoder encoder(coding.rans_chunk_symbols, coding.rans_interleave);
+        encoder.encode_with_indexes(symbol_vec, index_vec, cdf_table_);
+        return header + encoder.flush();
     }
+    // 每个线程复用自己的输出缓冲
+    thread_local DirectRansEncoder encoder;
+    header += encoder.encode_planes(symbols, plane, first_channel, n_channels, cdf_table_,
+                                    coding.rans_interleave, coding.skip_constant_channels ? skip.data() : nullptr);
+    return header;
+}
 
 
-    // decode
-    xt::xarray<float> output_xarray = xt::zeros<float>({N, C, H, W});
-    for (int ni=0; ni<N; ni++) {
-        std::string compressed_string = strings_list[ni];
-        xt::xarray<int> index_ni = xt::view(index_xarray, ni, xt::all(), xt::all(), xt::all());
-        std::vector<int> index_vec(index_ni.begin(), index_ni.end());
-        
-        std::vector<int32_t> values = rans_dec.decode_with_indexes(compressed_string, 
-                                                                    index_vec, 
-                                                                    quantized_cdf_, 
-                                                                    cdf_length_, 
-                                                                    offset_);
-        std::vector<size_t> values_shape{static_cast<size_t>(C), static_cast<size_t>(H), static_cast<size_t>(W)};
-        xt::xarray<int> values_xarray = xt::adapt(values, values_shape);
+void EntropyBottleNeck::decode_substream(const std::string& encoded, int first_channel, int n_channels,
+                                         size_t plane, float* output, const CodingOptions& coding) {
+    const float* medians = medians_.data() + first_channel;
+    std::vector<uint8_t> skip(n_channels, 0);
+    int n_coded = n_channels;
+    const char* stream = encoded.data();
+    size_t stream_size = encoded.size();
+    if (coding.skip_constant_channels) {
+        size_t header_size = decode_constant_channels(encoded, n_channels, plane, medians, output, skip.data());
+        n_coded -= std::count(skip.begin(), skip.end(), 1);
+        if (n_coded == 0) {
+            return;
+        }
+        // 头补齐到 4 字节 (见 encode_substream), rANS 码流原地解码, 不拷贝
+        header_size = (header_size + 3) & ~static_cast<size_t>(3);
+        if (header_size > encoded.size()) {
+            throw std::runtime_error("truncated constant channel header");
+        }
+        stream += header_size;
+        stream_size -= header_size;
+    }
 
-        auto t = xt::view(output_xarray, ni, xt::all(), xt::all(), xt::all());
-        t = xt::cast<float>(values_xarray);
+    RansDecoder decoder;
+    if (coding.entropy_coder != EntropyCoder::RansSimd && coding.rans_chunk_symbols == 0) {
+        decoder.decode_planes(stream, stream_size, plane, first_channel, n_channels, cdf_table_, medians, output,
+                              coding.rans_interleave, coding.skip_constant_channels ? skip.data() : nullptr);
+        return;
     }
 
-    output_xarray = output_xarray + medians_xarray;
+    // 这两种解码器需要逐符号的索引, 解码后再反量化
+    std::vector<int32_t> index_vec;
+    index_vec.reserve(n_coded * plane);
+    for (int c = 0; c < n_channels; c++) {
+        if (!skip[c]) {
+            index_vec.insert(index_vec.end(), plane, first_channel + c);
+        }
+    }
+    std::vector<int32_t> values;
+    if (coding.entropy_coder == EntropyCoder::RansSimd) {
+        // 解码器带有内部缓冲, 每个线程使用自己的实例
+        RansSimdDecoder simd_decoder;
+        values = simd_decoder.decode_with_indexes(stream, stream_size, index_vec, simd_table());
+    } else {
+        values = decoder.decode_chunked(stream, stream_size, index_vec, cdf_table_, coding.rans_interleave);
+    }
+    const int32_t* v = values.data();
+    for (int c = 0; c < n_channels; c++) {
+        if (skip[c]) {
+            continue;
+        }
+        float* out = output + c * plane;
+        for (size_t i = 0; i < plane; i++) {
+            out[i] = static_cast<float>(v[i]) + medians[c];
+        }
+        v += plane;
+    }
+}
 
-    return output_xarray;
+
+ThreadPool& EntropyBottleNeck::thread_pool() {
+    return shared_thread_pool();
 }
 
 
+const RansSimdTable& EntropyBottleNeck::simd_table() {
+    std::call_once(simd_table_once_, [this]() {
+        simd_table_ = std::make_unique<RansSimdTable>(cdf_table_);
+    });
+    return *simd_table_;
+}
 
 
 EntropyBottleNeck::~EntropyBottleNeck() {
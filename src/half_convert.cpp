@@ -0,0 +1,186 @@
+#include <cstring>
+#include "half_convert.h"
+
+#if defined(__F16C__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace {
+
+uint32_t float_bits(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+float bits_float(uint32_t x) {
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+uint16_t fp16_from_float(float f) {
+    const uint32_t x = float_bits(f);
+    const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+    uint32_t abs = x & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+        // inf / NaN, NaN 保持为 quiet NaN
+        return sign | (abs > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (abs >= 0x477ff000) {
+        // 舍入后超过 65504
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // fp16 的非规格化数: 加 0.5 后 float 尾数的最低位正好是 2^-24, 由 FPU 完成就近偶数舍入
+        const float shifted = bits_float(abs) + 0.5f;
+        return sign | static_cast<uint16_t>(float_bits(shifted) - 0x3f000000);
+    }
+    // 规格化数: 指数偏移 127 -> 15, 尾数 23 -> 10 位就近偶数舍入
+    abs += 0xc8000fff + ((abs >> 13) & 1);
+    return sign | static_cast<uint16_t>(abs >> 13);
+}
+
+float fp16_to_float_scalar(uint16_t h) {
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f;
+    const uint32_t mantissa = h & 0x3ff;
+    if (exponent == 0) {
+        return bits_float(sign | float_bits(static_cast<float>(mantissa) * 5.9604644775390625e-8f));
+    }
+    if (exponent == 31) {
+        return bits_float(sign | 0x7f800000 | (mantissa << 13));
+    }
+    return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+uint16_t bf16_from_float(float f) {
+    uint32_t x = float_bits(f);
+    if ((x & 0x7fffffff) > 0x7f800000) {
+        return static_cast<uint16_t>((x >> 16) | 0x40);
+    }
+    x += 0x7fff + ((x >> 16) & 1);
+    return static_cast<uint16_t>(x >> 16);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// 操作系统通过 XSAVE 保存的寄存器状态
+uint64_t xcr0() {
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 27))) {
+        return 0;
+    }
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+#endif
+
+} // namespace
+
+
+void float_to_fp16(const float* src, uint16_t* dst, size_t n) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = fp16_from_float(src[i]);
+    }
+}
+
+
+void fp16_to_float(const uint16_t* src, float* dst, size_t n) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = fp16_to_float_scalar(src[i]);
+    }
+}
+
+
+void float_to_bf16(const float* src, uint16_t* dst, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i quiet = _mm256_set1_epi32(0x00400000);
+    // 每次 16 个: 两组 8 个分别舍入后取高 16 位, packus 按 128 位通道交错, 再用 permute 恢复顺序
+    auto round8 = [&](const float* p) {
+        const __m256 v = _mm256_loadu_ps(p);
+        const __m256i x = _mm256_castps_si256(v);
+        const __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), one);
+        const __m256i rounded = _mm256_add_epi32(x, _mm256_add_epi32(bias, lsb));
+        const __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+        return _mm256_srli_epi32(_mm256_blendv_epi8(rounded, _mm256_or_si256(x, quiet), nan), 16);
+    };
+    for (; i + 16 <= n; i += 16) {
+        const __m256i packed = _mm256_packus_epi32(round8(src + i), round8(src + i + 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = bf16_from_float(src[i]);
+    }
+}
+
+
+void bf16_to_float(const uint16_t* src, float* dst, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        const __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_slli_epi32(x, 16));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = bits_float(static_cast<uint32_t>(src[i]) << 16);
+    }
+}
+
+
+bool cpu_supports_precision(ModelPrecision precision) {
+    if (precision != ModelPrecision::Fp16 && precision != ModelPrecision::Bf16) {
+        return true;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    const uint64_t xcr = xcr0();
+    // SSE, AVX, opmask, ZMM 高 256 位, ZMM16-31
+    const bool avx512_os = (xcr & 0xe6) == 0xe6;
+    // AMX TILECFG, TILEDATA
+    const bool amx_os = (xcr & 0x60000) == 0x60000;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    const uint32_t max_subleaf = eax;
+    const bool avx512_fp16 = (edx >> 23) & 1;
+    const bool amx_bf16 = (edx >> 22) & 1;
+    bool avx512_bf16 = false;
+    if (max_subleaf >= 1) {
+        __cpuid_count(7, 1, eax, ebx, ecx, edx);
+        avx512_bf16 = (eax >> 5) & 1;
+    }
+
+    if (precision == ModelPrecision::Fp16) {
+        return avx512_fp16 && avx512_os;
+    }
+    return (avx512_bf16 && avx512_os) || (amx_bf16 && amx_os);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <functional>
+#include "image_convert.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// 把 [0, n) 行分成若干块, 在 pool 中并行执行 fn(begin, end)
+void parallel_rows(uint32_t n, ThreadPool* pool, const std::function<void(uint32_t, uint32_t)>& fn) {
+    // 每块至少这么多行, 块太小时调度开销比转换本身还大
+    const uint32_t min_rows = 16;
+    const size_t chunks = pool == nullptr ? 1 : std::min<size_t>((pool->size() + 1) * 2, (n + min_rows - 1) / min_rows);
+    if (chunks <= 1) {
+        fn(0, n);
+        return;
+    }
+    const uint32_t step = static_cast<uint32_t>((n + chunks - 1) / chunks);
+    pool->parallel_for((n + step - 1) / step, [&](size_t i) {
+        const uint32_t begin = static_cast<uint32_t>(i) * step;
+        fn(begin, std::min(n, begin + step));
+    });
+}
+
+// n 个交错的 RGB8 像素拆成三个平面并除以 255
+void deinterleave_normalize(const uint8_t* src, size_t n, float* r, float* g, float* b) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    // 每次 16 个像素 (48 字节): 三次 pshufb 分别从三个 16 字节块中取出 R / G / B 再合并
+    const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    // float 除法是正确舍入的, 结果与 double 除法后再转 float 相同 (0 - 255 逐个验证过)
+    auto store16 = [&scale](__m128i v, float* dst) {
+        const __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+        const __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+        _mm256_storeu_ps(dst, _mm256_div_ps(lo, scale));
+        _mm256_storeu_ps(dst + 8, _mm256_div_ps(hi, scale));
+    };
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 16));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 32));
+        store16(_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, r0), _mm_shuffle_epi8(c, r1)), _mm_shuffle_epi8(d, r2)),
+                r + i);
+        store16(_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, g0), _mm_shuffle_epi8(c, g1)), _mm_shuffle_epi8(d, g2)),
+                g + i);
+        store16(_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, b0), _mm_shuffle_epi8(c, b1)), _mm_shuffle_epi8(d, b2)),
+                b + i);
+    }
+#endif
+    for (; i < n; i++) {
+        r[i] = src[i * 3] / 255.0f;
+        g[i] = src[i * 3 + 1] / 255.0f;
+        b[i] = src[i * 3 + 2] / 255.0f;
+    }
+}
+
+// clamp(0, 1) * 255 后截断, 用 double 计算, 与之前 xtensor 的 clip(x, 0.0, 1.0) * 255.0 再 cast 逐位相同
+inline uint8_t to_uint8(float v) {
+    return static_cast<uint8_t>(std::min(std::max(static_cast<double>(v), 0.0), 1.0) * 255.0);
+}
+
+// 三个平面各 n 个值转换后交错写入 dst
+void interleave_rgb8(const float* c0, const float* c1, const float* c2, size_t n, uint8_t* dst) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d scale = _mm256_set1_pd(255.0);
+    // 8 个 float -> 低 8 字节为 8 个 uint8, 两半分别扩展成 double 计算
+    auto convert8 = [&](const float* src) {
+        const __m256 v = _mm256_loadu_ps(src);
+        // max_pd 的任一操作数为 NaN 时返回第二个操作数, NaN 得到 0
+        __m256d lo = _mm256_max_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), zero);
+        __m256d hi = _mm256_max_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), zero);
+        lo = _mm256_mul_pd(_mm256_min_pd(lo, one), scale);
+        hi = _mm256_mul_pd(_mm256_min_pd(hi, one), scale);
+        const __m128i i16 = _mm_packs_epi32(_mm256_cvttpd_epi32(lo), _mm256_cvttpd_epi32(hi));
+        return _mm_packus_epi16(i16, i16);
+    };
+    // 24 个输出字节中第 k 个为像素 k / 3 的通道 k % 3, 前两个通道来自 v01 (c0 在低 8 字节, c1 在高 8 字节), 第三个来自 v2
+    const __m128i c01_lo = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+    const __m128i c2_lo = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i c01_hi = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i c2_hi = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v01 = _mm_unpacklo_epi64(convert8(c0 + i), convert8(c1 + i));
+        const __m128i v2 = convert8(c2 + i);
+        const __m128i lo = _mm_or_si128(_mm_shuffle_epi8(v01, c01_lo), _mm_shuffle_epi8(v2, c2_lo));
+        const __m128i hi = _mm_or_si128(_mm_shuffle_epi8(v01, c01_hi), _mm_shuffle_epi8(v2, c2_hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), lo);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i * 3 + 16), hi);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i * 3] = to_uint8(c0[i]);
+        dst[i * 3 + 1] = to_uint8(c1[i]);
+        dst[i * 3 + 2] = to_uint8(c2[i]);
+    }
+}
+
+} // namespace
+
+
+void rgb8_to_planar(const uint8_t* rgb, size_t stride, bool bgr, uint32_t height, uint32_t width, uint32_t pad_top,
+                    uint32_t pad_left, uint32_t y0, uint32_t x0, uint32_t th, uint32_t tw, float* out,
+                    ThreadPool* pool) {
+    const size_t plane = static_cast<size_t>(th) * tw;
+    // BGR 输入只是交换第一个和第三个输出平面
+    const size_t first = bgr ? 2 * plane : 0;
+    const size_t third = bgr ? 0 : 2 * plane;
+    // 输出每行中落在图像内的列 [x_begin, x_end)
+    const int64_t left = static_cast<int64_t>(pad_left) - x0;
+    const uint32_t x_begin = static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(left, 0), tw));
+    const uint32_t x_end = static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(left + width, 0), tw));
+
+    parallel_rows(th, pool, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t r = begin; r < end; r++) {
+            float* dst[3] = {out + first + static_cast<size_t>(r) * tw, out + plane + static_cast<size_t>(r) * tw,
+                             out + third + static_cast<size_t>(r) * tw};
+            const int64_t iy = static_cast<int64_t>(y0) + r - pad_top;
+            if (iy < 0 || iy >= height || x_begin >= x_end) {
+                for (float* row : dst) {
+                    std::fill_n(row, tw, 0.0f);
+                }
+                continue;
+            }
+            for (float* row : dst) {
+                std::fill_n(row, x_begin, 0.0f);
+                std::fill(row + x_end, row + tw, 0.0f);
+            }
+            const uint8_t* src = rgb + static_cast<size_t>(iy) * stride + (x0 + x_begin - pad_left) * static_cast<size_t>(3);
+            deinterleave_normalize(src, x_end - x_begin, dst[0] + x_begin, dst[1] + x_begin, dst[2] + x_begin);
+        }
+    });
+}
+
+
+void planar_to_rgb8(const float* chw, size_t plane_h, size_t plane_w, uint32_t y0, uint32_t y1, uint32_t x0,
+                    uint32_t x1, uint8_t* dst, size_t dst_stride, bool bgr, ThreadPool* pool) {
+    if (y0 >= y1 || x0 >= x1) {
+        return;
+    }
+    const size_t plane = plane_h * plane_w;
+    // BGR 只是交换第一个和第三个平面
+    const float* first = chw + (bgr ? 2 * plane : 0);
+    const float* third = chw + (bgr ? 0 : 2 * plane);
+
+    parallel_rows(y1 - y0, pool, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t r = begin; r < end; r++) {
+            const size_t offset = static_cast<size_t>(y0 + r) * plane_w + x0;
+            interleave_rgb8(first + offset, chw + plane + offset, third + offset, x1 - x0, dst + r * dst_stride);
+        }
+    });
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <map>
 #include <fstream>
 #include <cstring>
@@ -7,19 +8,230 @@
 #include <string>
 #include <functional>
 #include <thread>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
 #include "onnx_model_wrapper.h"
+#include "half_convert.h"
+#include "thread_pool.h"
+#include "verbose.h"
 #include <filesystem>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <stdexcept>
 namespace fs = std::filesystem;
 
-OnnxModelInferenceWrapper::OnnxModelInferenceWrapper(const std::string& modelFilepath, bool useOPENVINO) 
-    : env_(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, modelFilepath.c_str()),
+namespace {
+
+std::mutex ort_env_mutex;
+std::optional<OrtThreadOptions> configured_thread_options;
+std::unique_ptr<Ort::Env> ort_env;
+std::unique_ptr<ThreadPool> shared_pool;
+
+OrtThreadOptions thread_options_from_environment() {
+    OrtThreadOptions options;
+    if (const char* value = std::getenv("AICODEC_ORT_INTRA_THREADS")) {
+        options.intra_op_threads = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    }
+    if (const char* value = std::getenv("AICODEC_ORT_INTER_THREADS")) {
+        options.inter_op_threads = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    }
+    if (const char* value = std::getenv("AICODEC_ORT_SPINNING")) {
+        options.allow_spinning = std::string(value) != "0";
+    }
+    if (const char* value = std::getenv("AICODEC_ORT_AFFINITY")) {
+        options.intra_op_affinity = value;
+    }
+    return options;
+}
+
+// 所有 session 共享的 Env, 第一次使用时按 ort_thread_options() 创建全局线程池
+Ort::Env& shared_ort_env() {
+    std::lock_guard<std::mutex> lock(ort_env_mutex);
+    if (!ort_env) {
+        const OrtThreadOptions options = configured_thread_options ? *configured_thread_options
+                                                                   : thread_options_from_environment();
+        std::cout << "----------ort global threads: intra " << options.intra_op_threads << ", inter "
+                  << options.inter_op_threads << ", spinning " << options.allow_spinning << std::endl;
+
+        Ort::ThreadingOptions threadingOptions;
+        threadingOptions.SetGlobalIntraOpNumThreads(static_cast<int>(options.intra_op_threads));
+        threadingOptions.SetGlobalInterOpNumThreads(static_cast<int>(options.inter_op_threads));
+        threadingOptions.SetGlobalSpinControl(options.allow_spinning ? 1 : 0);
+        if (!options.intra_op_affinity.empty()) {
+            // C++ API 没有包装这个函数
+            Ort::ThrowOnError(Ort::GetApi().SetGlobalIntraOpThreadAffinity(threadingOptions,
+                                                                          options.intra_op_affinity.c_str()));
+        }
+        ort_env = std::make_unique<Ort::Env>(static_cast<const OrtThreadingOptions*>(threadingOptions),
+                                             OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "cmpai");
+    }
+    return *ort_env;
+}
+
+// run 的输入输出为 float32, 16 位浮点模型在边界上转换
+bool supported_io_type(ONNXTensorElementDataType type) {
+    return type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT || type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16 ||
+           type == ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16;
+}
+
+// 所有后端共用的设置
+Ort::SessionOptions base_session_options() {
+    Ort::SessionOptions sessionOptions;
+    sessionOptions.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+
+    // 使用 Env 的全局线程池, 线程数由 set_ort_thread_options / 环境变量控制
+    sessionOptions.DisablePerSessionThreads();
+    sessionOptions.EnableMemPattern();
+    sessionOptions.EnableCpuMemArena();
+    return sessionOptions;
+}
+
+// 当前 ORT 库没有编译该后端时返回 false, sessionOptions 不变
+bool append_execution_provider(Ort::SessionOptions& sessionOptions, ExecutionProvider provider) {
+    try {
+        switch (provider) {
+            case ExecutionProvider::OpenVino: {
+                OrtOpenVINOProviderOptions options;
+                options.device_type = "CPU_FP32";
+                sessionOptions.AppendExecutionProvider_OpenVINO(options);
+                break;
+            }
+            case ExecutionProvider::Xnnpack: {
+                // XNNPACK 使用自己的 pthreadpool, 不使用 ORT 的全局线程池
+                uint32_t threads = ort_thread_options().intra_op_threads;
+                if (threads == 0) {
+                    threads = std::max(1u, std::thread::hardware_concurrency());
+                }
+                sessionOptions.AppendExecutionProvider(
+                    "XNNPACK", std::unordered_map<std::string, std::string>{{"intra_op_num_threads", std::to_string(threads)}});
+                break;
+            }
+            case ExecutionProvider::Dnnl: {
+                // C++ API 没有包装 oneDNN 的选项
+                const OrtApi& api = Ort::GetApi();
+                OrtDnnlProviderOptions* dnnlOptions = nullptr;
+                Ort::ThrowOnError(api.CreateDnnlProviderOptions(&dnnlOptions));
+                std::unique_ptr<OrtDnnlProviderOptions, void (*)(OrtDnnlProviderOptions*)> guard(
+                    dnnlOptions, Ort::GetApi().ReleaseDnnlProviderOptions);
+                Ort::ThrowOnError(api.SessionOptionsAppendExecutionProvider_Dnnl(sessionOptions, dnnlOptions));
+                break;
+            }
+            default:
+                break;
+        }
+    } catch (const Ort::Exception& e) {
+        std::cout << "----------execution provider " << execution_provider_name(provider)
+                  << " is not available: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 模型文件内容的 FNV-1a 64 位哈希
+uint64_t file_hash(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    char buf[1 << 16];
+    while (file.read(buf, sizeof(buf)) || file.gcount() > 0) {
+        for (std::streamsize i = 0; i < file.gcount(); i++) {
+            hash = (hash ^ static_cast<uint8_t>(buf[i])) * 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+// 缓存文件名: <模型名>-<内容哈希>-ort<版本>.onnx, 模型或 ORT 版本变化时自动失效
+std::string optimized_model_path(const std::string& modelFilepath, const std::string& cacheDir) {
+    std::ostringstream name;
+    name << fs::path(modelFilepath).stem().string() << "-" << std::hex << std::setw(16) << std::setfill('0')
+         << file_hash(modelFilepath) << "-ort" << OrtGetApiBase()->GetVersionString() << ".onnx";
+    return (fs::path(cacheDir) / name.str()).string();
+}
+
+// 析构时删除 path (非空时), 创建 session 抛出异常时不留下写了一半的临时缓存文件
+struct TempFileGuard {
+    std::string path;
+
+    ~TempFileGuard() {
+        if (!path.empty()) {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+    }
+};
+
+} // namespace
+
+
+const char* execution_provider_name(ExecutionProvider provider) {
+    switch (provider) {
+        case ExecutionProvider::OpenVino:
+            return "openvino";
+        case ExecutionProvider::Xnnpack:
+            return "xnnpack";
+        case ExecutionProvider::Dnnl:
+            return "dnnl";
+        default:
+            return "cpu";
+    }
+}
+
+
+bool parse_execution_provider(const std::string& name, ExecutionProvider& provider) {
+    for (ExecutionProvider p : {ExecutionProvider::Cpu, ExecutionProvider::OpenVino, ExecutionProvider::Xnnpack,
+                                ExecutionProvider::Dnnl}) {
+        if (name == execution_provider_name(p)) {
+            provider = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void set_ort_thread_options(const OrtThreadOptions& options) {
+    std::lock_guard<std::mutex> lock(ort_env_mutex);
+    if (ort_env || shared_pool) {
+        throw std::runtime_error("ORT thread options must be set before the first session or thread pool is created");
+    }
+    configured_thread_options = options;
+}
+
+
+OrtThreadOptions ort_thread_options() {
+    std::lock_guard<std::mutex> lock(ort_env_mutex);
+    return configured_thread_options ? *configured_thread_options : thread_options_from_environment();
+}
+
+
+ThreadPool& shared_thread_pool() {
+    std::lock_guard<std::mutex> lock(ort_env_mutex);
+    if (!shared_pool) {
+        const OrtThreadOptions options = configured_thread_options ? *configured_thread_options
+                                                                   : thread_options_from_environment();
+        // ThreadPool(0) 为全部核
+        const uint32_t threads = options.intra_op_threads;
+        shared_pool = std::make_unique<ThreadPool>(threads == 0 ? 0 : std::max<uint32_t>(threads - 1, 1));
+    }
+    return *shared_pool;
+}
+
+OnnxModelInferenceWrapper::OnnxModelInferenceWrapper(const std::string& modelFilepath,
+                                                     const InferenceOptions& options) 
+    : env_(shared_ort_env()),
       sessionOptions_(),  // 默认构造
       session_(nullptr),  // 先初始化为nullptr
       allocator_(),
+      memoryInfo_(Ort::MemoryInfo::CreateCpu(OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault)),
       numInputNodes_(0),
       numOutputNodes_(0),
       inputType_(ONNXTensorElementDataType::ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED),
-      outputType_(ONNXTensorElementDataType::ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED)
+      outputType_(ONNXTensorElementDataType::ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED),
+      provider_(options.provider)
 {
 
     // 不存在
@@ -27,31 +239,57 @@ OnnxModelInferenceWrapper::OnnxModelInferenceWrapper(const std::string& modelFil
         throw std::runtime_error("modelFilepath " + modelFilepath + " not found");
     }
 
-    sessionOptions_.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
-
-    unsigned int num_threads = std::thread::hardware_concurrency();
-    if (num_threads == 0) num_threads = 1; // fallback
-    if (num_threads > 8) num_threads = 8;
-    if (num_threads > 16) num_threads = 16;
-    std::cout << "----------num_threads: " << num_threads << std::endl;
-    sessionOptions_.SetIntraOpNumThreads(num_threads);
-    sessionOptions_.SetInterOpNumThreads(1);
-    sessionOptions_.EnableMemPattern();
-    sessionOptions_.EnableCpuMemArena();
-    // sessionOptions_.SetOptimizedModelFilePath(std::string(modelFilepath + ".optimized").c_str());
+    sessionOptions_ = base_session_options();
+    if (provider_ != ExecutionProvider::Cpu && !append_execution_provider(sessionOptions_, provider_)) {
+        provider_ = ExecutionProvider::Cpu;
+    }
+    std::cout << "Execution Provider: " << execution_provider_name(provider_) << std::endl;
+
+    // 优化后模型的缓存, 其他后端的图由后端自身编译, 不缓存
+    std::string sessionModelPath = modelFilepath;
+    std::string cachedModelPath;
+    std::string cacheWritePath;
+    TempFileGuard cacheWriteGuard;
+    if (!options.optimized_model_cache_dir.empty() && provider_ == ExecutionProvider::Cpu) {
+        cachedModelPath = optimized_model_path(modelFilepath, options.optimized_model_cache_dir);
+        if (fs::exists(cachedModelPath)) {
+            std::cout << "load optimized model: " << cachedModelPath << std::endl;
+            sessionModelPath = cachedModelPath;
+            sessionOptions_.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+        } else {
+            // 先写入临时文件再改名, 多个进程同时加载时不会读到写了一半的缓存
+            fs::create_directories(options.optimized_model_cache_dir);
+            cacheWritePath = cachedModelPath + ".tmp" +
+                             std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+            sessionOptions_.SetOptimizedModelFilePath(cacheWritePath.c_str());
+            cacheWriteGuard.path = cacheWritePath;
+        }
+    }
 
+    //Creation: The Ort::Session is created here
+    try {
+        session_ = Ort::Session(env_, sessionModelPath.c_str(), sessionOptions_);
+    } catch (const Ort::Exception& e) {
+        // 后端库存在但初始化失败 (例如缺少依赖的动态库) 时退回默认 CPU
+        if (provider_ == ExecutionProvider::Cpu) {
+            throw;
+        }
+        std::cout << "----------execution provider " << execution_provider_name(provider_)
+                  << " failed, fall back to cpu: " << e.what() << std::endl;
+        provider_ = ExecutionProvider::Cpu;
+        sessionOptions_ = base_session_options();
+        session_ = Ort::Session(env_, modelFilepath.c_str(), sessionOptions_);
+    }
 
-    //Appending OpenVINO Execution Provider API
-    if (useOPENVINO) {
-        // Using OPENVINO backend
-        OrtOpenVINOProviderOptions options;
-        options.device_type = "CPU_FP32"; //Other options are: GPU_FP32, GPU_FP16, MYRIAD_FP16
-        std::cout << "OpenVINO device type is set to: " << options.device_type << std::endl;
-        sessionOptions_.AppendExecutionProvider_OpenVINO(options);
+    if (!cacheWritePath.empty()) {
+        std::error_code ec;
+        fs::rename(cacheWritePath, cachedModelPath, ec);
+        if (!ec) {
+            // 改名成功, 临时文件已不存在
+            cacheWriteGuard.path.clear();
+            std::cout << "save optimized model: " << cachedModelPath << std::endl;
+        }
     }
-    
-    //Creation: The Ort::Session is created here
-    session_ = Ort::Session(env_, modelFilepath.c_str(), sessionOptions_);
 
     allocator_ = Ort::AllocatorWithDefaultOptions();
 
@@ -87,79 +325,117 @@ OnnxModelInferenceWrapper::OnnxModelInferenceWrapper(const std::string& modelFil
     outputDims_ = outputTensorInfo.GetShape();
     std::cout << "Output Dimensions: " << outputDims_    << std::endl;
 
+    // 量化模型 (QDQ / QOperator) 的输入输出仍为 float32, 只有内部计算是 INT8
+    // FP16 / BF16 模型的输入输出在 run 中与 float32 转换
+    if (!supported_io_type(inputType_) || !supported_io_type(outputType_)) {
+        throw std::runtime_error("modelFilepath " + modelFilepath + " must have float32, float16 or bfloat16 input and output");
+    }
 }
 
 
 std::vector<std::vector<float>> OnnxModelInferenceWrapper::run(const xt::xarray<float>& input, const std::vector<int64_t>& inputDims, const std::vector<int64_t>& outputDims) {
-    auto tic = std::chrono::high_resolution_clock::now();
-
-    //Run Inference
-
-    /* To run inference using ONNX Runtime, the user is responsible for creating and managing the 
-    input and output buffers. These buffers could be created and managed via std::vector.
-    The linear-format input data should be copied to the buffer for ONNX Runtime inference. */
-
-
-    int inputTensorSize = vectorProduct(inputDims);
-    // std::vector<float> inputTensorValues(input.begin(), input.end());
-    // std::cout << "Input Tensor Values: " << inputTensorValues.size() << std::endl;
-
-    int outputTensorSize = vectorProduct(outputDims);
-    
-    // 根据输出类型创建正确的tensor
-    std::vector<float> outputTensorValues;
-    outputTensorValues.resize(outputTensorSize);
-
+    if (input.size() != static_cast<size_t>(vectorProduct(inputDims))) {
+        throw std::runtime_error("input size does not match inputDims");
+    }
+    return run(input.data(), inputDims, outputDims);
+}
 
-    /* Once the buffers were created, they would be used for creating instances of Ort::Value 
-    which is the tensor format for ONNX Runtime. There could be multiple inputs for a neural network, 
-    so we have to prepare an array of Ort::Value instances for inputs and outputs respectively even if 
-    we only have one input and one output. */
 
-    std::vector<const char*> inputNames{inputName_.c_str()};
-    std::vector<const char*> outputNames{outputName_.c_str()};
+std::vector<std::vector<float>> OnnxModelInferenceWrapper::run(const float* input, const std::vector<int64_t>& inputDims, const std::vector<int64_t>& outputDims) {
+    std::vector<float> outputTensorValues(vectorProduct(outputDims));
+    run(input, inputDims, outputTensorValues.data(), outputDims);
 
-    std::vector<Ort::Value> inputTensors;
-    std::vector<Ort::Value> outputTensors;
+    std::vector<std::vector<float>> outputTensors_list;
+    outputTensors_list.push_back(std::move(outputTensorValues));
+    return outputTensors_list;
+}
 
-    /*
-    Creating ONNX Runtime inference sessions, querying input and output names, 
-    dimensions, and types are trivial.
-    Setup inputs & outputs: The input & output tensors are created here. */
 
-    Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(
-        OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
-    
-    std::cout << "memoryInfo created"  << std::endl;
+void OnnxModelInferenceWrapper::run(const float* input, const std::vector<int64_t>& inputDims, float* output, const std::vector<int64_t>& outputDims) {
+    auto tic = std::chrono::high_resolution_clock::now();
 
-    inputTensors.push_back(Ort::Value::CreateTensor<float>(
-        memoryInfo, const_cast<float*>(input.data()), inputTensorSize, inputDims.data(),
-        inputDims.size()));
-    
-    std::cout << "inputTensors: " << inputTensors.size() << std::endl;
+    /* The input and output tensors are views of the caller's buffers: ONNX Runtime reads the input
+    in place and writes the result straight into output. Bindings are kept in a small pool, one per
+    concurrent caller, and only rebound when a buffer pointer or shape differs from the previous run.
+    16-bit models go through per-thread half buffers that are converted from / to float32 here. */
+    const size_t inputSize = vectorProduct(inputDims);
+    const size_t outputSize = vectorProduct(outputDims);
+    thread_local std::vector<uint16_t> halfInput;
+    thread_local std::vector<uint16_t> halfOutput;
+
+    const void* inputData = input;
+    if (inputType_ != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) {
+        halfInput.resize(inputSize);
+        if (inputType_ == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16) {
+            float_to_fp16(input, halfInput.data(), inputSize);
+        } else {
+            float_to_bf16(input, halfInput.data(), inputSize);
+        }
+        inputData = halfInput.data();
+    }
+    void* outputData = output;
+    if (outputType_ != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) {
+        halfOutput.resize(outputSize);
+        outputData = halfOutput.data();
+    }
 
-    outputTensors.push_back(Ort::Value::CreateTensor<float>(
-        memoryInfo, outputTensorValues.data(), outputTensorSize,
-            outputDims.data(), outputDims.size()));
+    std::unique_ptr<BoundIo> io;
+    {
+        std::lock_guard<std::mutex> lock(bindingMutex_);
+        if (!idleBindings_.empty()) {
+            io = std::move(idleBindings_.back());
+            idleBindings_.pop_back();
+        }
+    }
+    if (!io) {
+        io = std::make_unique<BoundIo>(session_);
+    }
 
-    /* To run inference, we provide the run options, an array of input names corresponding to the 
-    inputs in the input tensor, an array of input tensor, number of inputs, an array of output names 
-    corresponding to the the outputs in the output tensor, an array of output tensor, number of outputs. */
-    session_.Run(Ort::RunOptions{nullptr}, inputNames.data(),
-                inputTensors.data(), 1, outputNames.data(),
-                outputTensors.data(), 1);
+    if (io->inputData != inputData || io->inputDims != inputDims) {
+        io->binding.ClearBoundInputs();
+        if (inputType_ == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) {
+            io->inputTensor = Ort::Value::CreateTensor<float>(
+                memoryInfo_, const_cast<float*>(input), inputSize, inputDims.data(), inputDims.size());
+        } else {
+            io->inputTensor = Ort::Value::CreateTensor(memoryInfo_, halfInput.data(), inputSize * sizeof(uint16_t),
+                                                       inputDims.data(), inputDims.size(), inputType_);
+        }
+        io->binding.BindInput(inputName_.c_str(), io->inputTensor);
+        io->inputData = inputData;
+        io->inputDims = inputDims;
+    }
+    if (io->outputData != outputData || io->outputDims != outputDims) {
+        io->binding.ClearBoundOutputs();
+        if (outputType_ == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) {
+            io->outputTensor = Ort::Value::CreateTensor<float>(
+                memoryInfo_, output, outputSize, outputDims.data(), outputDims.size());
+        } else {
+            io->outputTensor = Ort::Value::CreateTensor(memoryInfo_, halfOutput.data(), outputSize * sizeof(uint16_t),
+                                                        outputDims.data(), outputDims.size(), outputType_);
+        }
+        io->binding.BindOutput(outputName_.c_str(), io->outputTensor);
+        io->outputData = outputData;
+        io->outputDims = outputDims;
+    }
 
-    std::vector<std::vector<float>> outputTensors_list;
-    uint32_t output_size = outputTensors.size();
-    for (uint32_t i = 0; i < output_size; i++) {
-        outputTensors_list.push_back(outputTensorValues);
+    // 抛出异常时这个绑定随 io 释放, 不放回
+    session_.Run(Ort::RunOptions{nullptr}, io->binding);
+    {
+        std::lock_guard<std::mutex> lock(bindingMutex_);
+        idleBindings_.push_back(std::move(io));
     }
 
-    auto toc = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(toc - tic);
-    std::cout << "OnnxModelInferenceWrapper::run time taken: " << duration.count() << " milliseconds" << std::endl;
+    if (outputType_ == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16) {
+        fp16_to_float(halfOutput.data(), output, outputSize);
+    } else if (outputType_ == ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16) {
+        bf16_to_float(halfOutput.data(), output, outputSize);
+    }
 
-    return outputTensors_list;
+    if (verbose()) {
+        auto toc = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(toc - tic);
+        std::cout << "OnnxModelInferenceWrapper::run time taken: " << duration.count() << " milliseconds" << std::endl;
+    }
 }
 
 OnnxModelInferenceWrapper::~OnnxModelInferenceWrapper() {
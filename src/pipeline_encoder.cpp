@@ -0,0 +1,204 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include "pipeline_encoder.h"
+
+namespace {
+
+// 有界阻塞队列, 队列满时 push 阻塞, close 之后 pop 取完剩余元素返回 false
+template <typename T>
+class BoundedQueue {
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+        void push(T item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this]() { return items_.size() < capacity_; });
+            items_.push(std::move(item));
+            not_empty_.notify_one();
+        }
+
+        bool pop(T& item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+            if (items_.empty()) {
+                return false;
+            }
+            item = std::move(items_.front());
+            items_.pop();
+            not_full_.notify_one();
+            return true;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            not_empty_.notify_all();
+        }
+
+    private:
+        size_t capacity_;
+        std::queue<T> items_;
+        bool closed_ = false;
+        std::mutex mutex_;
+        std::condition_variable not_full_;
+        std::condition_variable not_empty_;
+};
+
+// 一张图像在各阶段之间传递的全部数据
+struct Job {
+    std::string input_file;
+    std::string output_file;
+    Params params;
+    // imread 得到的 BGR 图像, 预处理和 g_a 直接读取, 不转换成 RGB
+    cv::Mat image;
+    EncodeStage stage;
+    // 之前的阶段失败时之后的阶段跳过该图像
+    std::exception_ptr error;
+};
+using JobQueue = BoundedQueue<std::unique_ptr<Job>>;
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point begin, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// 从 in 取图像, 执行 fn 后放入 out, out 为 nullptr 时为最后一个阶段, 记录第一个失败图像的异常
+void run_stage(JobQueue& in, JobQueue* out, PipelineStageStats& stats, const std::function<void(Job&)>& fn,
+               std::exception_ptr& first_error) {
+    while (true) {
+        std::unique_ptr<Job> job;
+        auto t0 = Clock::now();
+        if (!in.pop(job)) {
+            break;
+        }
+        auto t1 = Clock::now();
+        stats.starved_ms += elapsed_ms(t0, t1);
+
+        if (!job->error) {
+            try {
+                fn(*job);
+            } catch (...) {
+                job->error = std::current_exception();
+            }
+        }
+        auto t2 = Clock::now();
+        stats.busy_ms += elapsed_ms(t1, t2);
+        stats.items++;
+
+        if (out != nullptr) {
+            out->push(std::move(job));
+            stats.blocked_ms += elapsed_ms(t2, Clock::now());
+        } else if (job->error && !first_error) {
+            first_error = job->error;
+        }
+    }
+    if (out != nullptr) {
+        out->close();
+    }
+}
+
+} // namespace
+
+
+PipelineStats encode_files_pipelined(const std::vector<std::pair<std::string, std::string>>& files,
+                                     const Params& params, Codec& codec, size_t queue_depth) {
+    PipelineStats stats;
+    stats.stages.resize(5);
+    stats.stages[0].name = "read";
+    stats.stages[1].name = "preprocess";
+    stats.stages[2].name = "g_a";
+    stats.stages[3].name = "entropy";
+    stats.stages[4].name = "write";
+
+    JobQueue read_queue(queue_depth);
+    JobQueue prepare_queue(queue_depth);
+    JobQueue analysis_queue(queue_depth);
+    JobQueue entropy_queue(queue_depth);
+    // 只在各阶段线程中写入, 全部线程结束后读取
+    std::exception_ptr unused_error;
+    std::exception_ptr first_error;
+
+    auto start_time = Clock::now();
+
+    // 读图阶段没有输入队列, 直接遍历 files
+    std::thread reader([&]() {
+        PipelineStageStats& read = stats.stages[0];
+        for (const auto& file : files) {
+            auto t0 = Clock::now();
+            auto job = std::make_unique<Job>();
+            job->input_file = file.first;
+            job->output_file = file.second;
+            job->params = params;
+            try {
+                job->image = cv::imread(file.first);
+                if (job->image.empty()) {
+                    throw std::runtime_error("failed to read image " + file.first);
+                }
+                job->params.original_height = job->image.rows;
+                job->params.original_width = job->image.cols;
+            } catch (...) {
+                job->error = std::current_exception();
+            }
+            auto t1 = Clock::now();
+            read.busy_ms += elapsed_ms(t0, t1);
+            read.items++;
+            read_queue.push(std::move(job));
+            read.blocked_ms += elapsed_ms(t1, Clock::now());
+        }
+        read_queue.close();
+    });
+
+    std::thread preprocess([&]() {
+        run_stage(read_queue, &prepare_queue, stats.stages[1],
+                  [&codec](Job& job) {
+                      ImageView image;
+                      image.data = job.image.data;
+                      image.width = job.image.cols;
+                      image.height = job.image.rows;
+                      image.stride = job.image.step;
+                      image.order = ChannelOrder::Bgr;
+                      codec.encode_prepare(job.params, image, job.stage);
+                  }, unused_error);
+    });
+    std::thread analysis([&]() {
+        run_stage(prepare_queue, &analysis_queue, stats.stages[2], [&codec](Job& job) {
+            codec.encode_analysis(job.params, job.stage);
+            // g_a 之后不再需要输入和原图
+            job.stage.input = std::vector<float>();
+            job.stage.image = ImageView();
+            job.image.release();
+        }, unused_error);
+    });
+    std::thread entropy([&]() {
+        run_stage(analysis_queue, &entropy_queue, stats.stages[3], [&codec](Job& job) {
+            codec.encode_entropy(job.params, job.stage);
+            job.stage.y = std::vector<float>();
+        }, unused_error);
+    });
+
+    // 写文件在调用线程
+    run_stage(entropy_queue, nullptr, stats.stages[4],
+              [](Job& job) { save_compressed(job.params, job.output_file); }, first_error);
+
+    reader.join();
+    preprocess.join();
+    analysis.join();
+    entropy.join();
+    stats.wall_ms = elapsed_ms(start_time, Clock::now());
+
+    if (first_error) {
+        std::rethrow_exception(first_error);
+    }
+    return stats;
+}
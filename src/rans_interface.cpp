@@ -33,6 +33,7 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstring>
 #include <numeric>
 #include <stdexcept>
 #include <string>
@@ -107,6 +108,288 @@ inline uint32_t Rans64DecGetBits(Rans64State *r, uint32_t **pptr,
 
   return val;
 }
+
+/* Raw value coded in bypass mode after an escape (max_value) symbol */
+inline uint32_t escape_raw_value(int32_t value, int32_t max_value) {
+  return value < 0 ? static_cast<uint32_t>(-2 * value - 1)
+                   : static_cast<uint32_t>(2 * (value - max_value));
+}
+
+inline int32_t bypass_count(uint32_t raw_val) {
+  int32_t n_bypass = 0;
+  while (n_bypass * bypass_precision < 32 &&
+         (raw_val >> (n_bypass * bypass_precision)) != 0) {
+    ++n_bypass;
+  }
+  return n_bypass;
+}
+
+/* Number of bypass puts written for a raw value */
+inline size_t bypass_puts(uint32_t raw_val) {
+  const int32_t n_bypass = bypass_count(raw_val);
+  return n_bypass / max_bypass_val + 1 + n_bypass;
+}
+
+/* Encodes a raw value in bypass mode, in the reverse order of
+ * BufferedRansEncoder::push_symbol as rANS encodes backwards */
+inline void Rans64EncPutBypass(Rans64State *r, uint32_t **pptr,
+                               uint32_t raw_val) {
+  const int32_t n_bypass = bypass_count(raw_val);
+  for (int32_t j = n_bypass; j-- > 0;) {
+    Rans64EncPutBits(r, pptr, (raw_val >> (j * bypass_precision)) & max_bypass_val,
+                     bypass_precision);
+  }
+  Rans64EncPutBits(r, pptr, n_bypass % max_bypass_val, bypass_precision);
+  for (int32_t j = n_bypass / max_bypass_val; j > 0; --j) {
+    Rans64EncPutBits(r, pptr, max_bypass_val, bypass_precision);
+  }
+}
+
+/* Decodes the raw value following an escape (max_value) symbol */
+inline int32_t Rans64DecBypass(Rans64State *r, uint32_t **pptr,
+                               int32_t max_value) {
+  int32_t val = Rans64DecGetBits(r, pptr, bypass_precision);
+  int32_t n_bypass = val;
+
+  while (val == max_bypass_val) {
+    val = Rans64DecGetBits(r, pptr, bypass_precision);
+    n_bypass += val;
+  }
+
+  int32_t raw_val = 0;
+  for (int j = 0; j < n_bypass; ++j) {
+    val = Rans64DecGetBits(r, pptr, bypass_precision);
+    assert(val <= max_bypass_val);
+    raw_val |= val << (j * bypass_precision);
+  }
+  int32_t value = raw_val >> 1;
+  if (raw_val & 1) {
+    value = -value - 1;
+  } else {
+    value += max_value;
+  }
+  return value;
+}
+} // namespace
+
+RansCdfTable::RansCdfTable(const std::vector<std::vector<int32_t>> &cdfs,
+                           const std::vector<int32_t> &cdfs_sizes,
+                           const std::vector<int32_t> &offsets)
+    : cdfs_sizes(cdfs_sizes), offsets(offsets) {
+  assert(cdfs.size() == cdfs_sizes.size());
+
+  size_t cdfs_stride = 0;
+  for (size_t i = 0; i < cdfs.size(); ++i) {
+    if (cdfs_sizes[i] > static_cast<int32_t>(cdfs[i].size())) {
+      throw std::runtime_error("Invalid cdf " + std::to_string(i));
+    }
+    cdfs_stride = std::max(cdfs_stride, cdfs[i].size());
+  }
+
+  std::vector<int32_t> packed(cdfs.size() * cdfs_stride);
+  for (size_t i = 0; i < cdfs.size(); ++i) {
+    std::copy(cdfs[i].begin(), cdfs[i].end(), packed.begin() + i * cdfs_stride);
+  }
+  init(packed.data(), cdfs_stride);
+}
+
+RansCdfTable::RansCdfTable(const int32_t *cdfs, size_t cdfs_stride,
+                           const std::vector<int32_t> &cdfs_sizes,
+                           const std::vector<int32_t> &offsets)
+    : cdfs_sizes(cdfs_sizes), offsets(offsets) {
+  for (size_t i = 0; i < cdfs_sizes.size(); ++i) {
+    if (cdfs_sizes[i] > static_cast<int32_t>(cdfs_stride)) {
+      throw std::runtime_error("Invalid cdf " + std::to_string(i));
+    }
+  }
+  init(cdfs, cdfs_stride);
+}
+
+void RansCdfTable::init(const int32_t *cdfs, size_t cdfs_stride) {
+  assert(cdfs_sizes.size() == offsets.size());
+
+  constexpr uint32_t n_slots = 1u << lookup_bits;
+  constexpr int slot_shift = precision - lookup_bits;
+  static_assert(slot_shift >= 0, "lookup_bits > precision");
+
+  /* rows padded to whole cache lines */
+  constexpr size_t line = CacheAlignedAllocator<int32_t>::alignment;
+  constexpr size_t cdf_align = line / sizeof(int32_t);
+  constexpr size_t sym_align = 8; // lcm of the symbol sizes with a line
+  static_assert((sym_align * sizeof(Rans64EncSymbol)) % line == 0 &&
+                    (sym_align * sizeof(Rans64DecSymbol)) % line == 0,
+                "symbol rows are not cache line aligned");
+
+  const size_t n = cdfs_sizes.size();
+  size_t max_size = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const int32_t *cdf = cdfs + i * cdfs_stride;
+    if (cdfs_sizes[i] < 2 || cdfs_sizes[i] - 1 > 0xFFFF || cdf[0] != 0 ||
+        cdf[cdfs_sizes[i] - 1] != (1 << precision)) {
+      throw std::runtime_error("Invalid cdf " + std::to_string(i));
+    }
+    max_size = std::max(max_size, static_cast<size_t>(cdfs_sizes[i]));
+  }
+  _stride = (max_size + cdf_align - 1) / cdf_align * cdf_align;
+  _sym_stride = (max_size - 1 + sym_align - 1) / sym_align * sym_align;
+
+  _cdf.assign(n * _stride, 1 << precision);
+  _enc_syms.assign(n * _sym_stride, Rans64EncSymbol{});
+  _dec_syms.assign(n * _sym_stride, Rans64DecSymbol{});
+  _lookup.resize(n * n_slots);
+  for (size_t i = 0; i < n; ++i) {
+    const int32_t *cdf = cdfs + i * cdfs_stride;
+    std::copy(cdf, cdf + cdfs_sizes[i], _cdf.begin() + i * _stride);
+
+    Rans64EncSymbol *enc = _enc_syms.data() + i * _sym_stride;
+    Rans64DecSymbol *dec = _dec_syms.data() + i * _sym_stride;
+    for (int32_t s = 0; s < cdfs_sizes[i] - 1; ++s) {
+      Rans64EncSymbolInit(&enc[s], cdf[s], cdf[s + 1] - cdf[s], precision);
+      Rans64DecSymbolInit(&dec[s], cdf[s], cdf[s + 1] - cdf[s]);
+    }
+
+    uint16_t *slots = _lookup.data() + i * n_slots;
+    uint32_t s = 0;
+    for (uint32_t slot = 0; slot < n_slots; ++slot) {
+      const int32_t slot_start = static_cast<int32_t>(slot << slot_shift);
+      while (cdf[s + 1] <= slot_start) {
+        ++s;
+      }
+      slots[slot] = static_cast<uint16_t>(s);
+    }
+  }
+}
+
+inline uint32_t RansCdfTable::find(int32_t cdf_idx, uint32_t cum_freq) const {
+  const int32_t *cdf = cdf_data(cdf_idx);
+  uint32_t s = 0;
+  if (cdfs_sizes[cdf_idx] > linear_search_max) {
+    s = _lookup[(static_cast<size_t>(cdf_idx) << lookup_bits) |
+                (cum_freq >> (precision - lookup_bits))];
+  }
+  /* short cdfs are scanned from the start: a predictable scan beats the
+   * dependent table load */
+  while (static_cast<uint32_t>(cdf[s + 1]) <= cum_freq) {
+    ++s;
+  }
+  return s;
+}
+
+namespace {
+
+inline int32_t Rans64DecSymbolWithTable(Rans64State *r, uint32_t **pptr,
+                                        int32_t cdf_idx,
+                                        const RansCdfTable &table) {
+  assert(cdf_idx >= 0);
+  assert(cdf_idx < static_cast<int32_t>(table.size()));
+
+  const int32_t max_value = table.cdfs_sizes[cdf_idx] - 2;
+
+  const uint32_t cum_freq = Rans64DecGet(r, precision);
+  const uint32_t s = table.find(cdf_idx, cum_freq);
+
+  Rans64DecAdvanceSymbol(r, pptr, table.dec_symbols(cdf_idx) + s, precision);
+
+  int32_t value = static_cast<int32_t>(s);
+  if (value == max_value) {
+    value = Rans64DecBypass(r, pptr, max_value);
+  }
+  return value + table.offsets[cdf_idx];
+}
+
+/* Symbol i is decoded by state i % K, all states share the word pointer.
+ * Unrolling over K independent states lets their table lookups and
+ * multiplies overlap instead of waiting on a single state. */
+template <uint32_t K>
+void decode_interleaved(uint32_t *ptr, const int32_t *indexes, size_t size,
+                        const RansCdfTable &table, int32_t *output) {
+  Rans64State rans[K];
+  for (uint32_t k = 0; k < K; ++k) {
+    Rans64DecInit(&rans[k], &ptr);
+  }
+
+  size_t i = 0;
+  for (; i + K <= size; i += K) {
+    for (uint32_t k = 0; k < K; ++k) {
+      output[i + k] =
+          Rans64DecSymbolWithTable(&rans[k], &ptr, indexes[i + k], table);
+    }
+  }
+  for (uint32_t k = 0; i < size; ++i, ++k) {
+    output[i] = Rans64DecSymbolWithTable(&rans[k], &ptr, indexes[i], table);
+  }
+}
+
+void decode_interleaved(uint32_t n_states, uint32_t *ptr,
+                        const int32_t *indexes, size_t size,
+                        const RansCdfTable &table, int32_t *output) {
+  switch (n_states) {
+  case 1:
+    decode_interleaved<1>(ptr, indexes, size, table, output);
+    break;
+  case 2:
+    decode_interleaved<2>(ptr, indexes, size, table, output);
+    break;
+  case 4:
+    decode_interleaved<4>(ptr, indexes, size, table, output);
+    break;
+  case 8:
+    decode_interleaved<8>(ptr, indexes, size, table, output);
+    break;
+  }
+}
+
+/* Same symbol to state mapping as decode_interleaved() for the planes of
+ * DirectRansEncoder::encode_planes, plane p being decoded with cdf
+ * first_cdf + p. Writes float(value) + bias[p]. */
+template <uint32_t K>
+void decode_planes_interleaved(uint32_t *ptr, size_t plane_size,
+                               int32_t first_cdf, int32_t n_planes,
+                               const RansCdfTable &table, const float *bias,
+                               float *output, const uint8_t *skip) {
+  Rans64State rans[K];
+  for (uint32_t k = 0; k < K; ++k) {
+    Rans64DecInit(&rans[k], &ptr);
+  }
+
+  size_t i = 0;
+  for (int32_t p = 0; p < n_planes; ++p) {
+    if (skip && skip[p]) {
+      continue;
+    }
+    const int32_t cdf_idx = first_cdf + p;
+    const float b = bias[p];
+    float *out = output + p * plane_size;
+
+    size_t j = 0;
+    /* back on state 0 before the unrolled loop */
+    for (; j < plane_size && (i & (K - 1)) != 0; ++j, ++i) {
+      out[j] = static_cast<float>(Rans64DecSymbolWithTable(
+                   &rans[i & (K - 1)], &ptr, cdf_idx, table)) +
+               b;
+    }
+    for (; j + K <= plane_size; j += K, i += K) {
+      for (uint32_t k = 0; k < K; ++k) {
+        out[j + k] = static_cast<float>(Rans64DecSymbolWithTable(
+                         &rans[k], &ptr, cdf_idx, table)) +
+                     b;
+      }
+    }
+    for (; j < plane_size; ++j, ++i) {
+      out[j] = static_cast<float>(Rans64DecSymbolWithTable(
+                   &rans[i & (K - 1)], &ptr, cdf_idx, table)) +
+               b;
+    }
+  }
+}
+
+void check_interleave(uint32_t n_states) {
+  if (n_states == 0 || n_states > rans_max_interleave ||
+      (n_states & (n_states - 1)) != 0) {
+    throw std::invalid_argument("Unsupported rANS interleave factor " +
+                                std::to_string(n_states));
+  }
+}
 } // namespace
 
 void BufferedRansEncoder::encode_with_indexes(
@@ -135,80 +418,272 @@ void BufferedRansEncoder::encode_with_indexes(
     assert(max_value >= 0 && "max_value < 0");
     assert((max_value + 1) < cdf.size() && "max_value + 1 >= cdf.size()");
 
-    int32_t value = symbols[i] - offsets[cdf_idx];
-    // std::cout << "value: " << value << " " << symbols[i] << " " << offsets[cdf_idx] << std::endl;
-    uint32_t raw_val = 0;
-    if (value < 0) {
-      raw_val = -2 * value - 1;
-      value = max_value;
-    } else if (value >= max_value) {
-      raw_val = 2 * (value - max_value);
-      value = max_value;
-    }
+    push_symbol(symbols[i] - offsets[cdf_idx], cdf.data(), max_value);
+  }
+}
 
-    assert(value >= 0 && "value < 0");
-    assert(value < cdfs_sizes[cdf_idx] - 1 && "value >= cdfs_sizes[cdf_idx] - 1");
+size_t BufferedRansEncoder::encode_symbol(int32_t symbol, int32_t cdf_idx,
+                                          const RansCdfTable &table) {
+  assert(cdf_idx >= 0 && cdf_idx < static_cast<int32_t>(table.size()));
+  push_symbol(symbol - table.offsets[cdf_idx], table.cdf_data(cdf_idx),
+              table.cdfs_sizes[cdf_idx] - 2);
+  return _syms.size();
+}
 
-    _syms.push_back({static_cast<uint16_t>(cdf[value]),
-                     static_cast<uint16_t>(cdf[value + 1] - cdf[value]),
-                     false});
+void BufferedRansEncoder::push_symbol(int32_t value, const int32_t *cdf,
+                                      int32_t max_value) {
+  uint32_t raw_val = 0;
+  if (value < 0) {
+    raw_val = -2 * value - 1;
+    value = max_value;
+  } else if (value >= max_value) {
+    raw_val = 2 * (value - max_value);
+    value = max_value;
+  }
 
-    /* Bypass coding mode (value == max_value -> sentinel flag) */
-    if (value == max_value) {
-      /* Determine the number of bypasses (in bypass_precision size) needed to
-       * encode the raw value. */
-      int32_t n_bypass = 0;
-      while ((raw_val >> (n_bypass * bypass_precision)) != 0) {
-        ++n_bypass;
-      }
+  assert(value >= 0 && "value < 0");
+  assert(value <= max_value && "value > max_value");
+
+  _syms.push_back({static_cast<uint16_t>(cdf[value]),
+                   static_cast<uint16_t>(cdf[value + 1] - cdf[value]),
+                   false});
+  ++_n_symbols;
+
+  /* Bypass coding mode (value == max_value -> sentinel flag) */
+  if (value == max_value) {
+    /* Determine the number of bypasses (in bypass_precision size) needed to
+     * encode the raw value. */
+    const int32_t n_bypass = bypass_count(raw_val);
+
+    /* Encode number of bypasses */
+    int32_t val = n_bypass;
+    while (val >= max_bypass_val) {
+      _syms.push_back({max_bypass_val, max_bypass_val + 1, true});
+      val -= max_bypass_val;
+    }
+    _syms.push_back(
+        {static_cast<uint16_t>(val), static_cast<uint16_t>(val + 1), true});
 
-      /* Encode number of bypasses */
-      int32_t val = n_bypass;
-      while (val >= max_bypass_val) {
-        _syms.push_back({max_bypass_val, max_bypass_val + 1, true});
-        val -= max_bypass_val;
-      }
+    /* Encode raw value */
+    for (int32_t j = 0; j < n_bypass; ++j) {
+      const int32_t val =
+          (raw_val >> (j * bypass_precision)) & max_bypass_val;
       _syms.push_back(
           {static_cast<uint16_t>(val), static_cast<uint16_t>(val + 1), true});
-
-      /* Encode raw value */
-      for (int32_t j = 0; j < n_bypass; ++j) {
-        const int32_t val =
-            (raw_val >> (j * bypass_precision)) & max_bypass_val;
-        _syms.push_back(
-            {static_cast<uint16_t>(val), static_cast<uint16_t>(val + 1), true});
-      }
     }
   }
 }
 
-std::string BufferedRansEncoder::flush() {
-  Rans64State rans;
-  Rans64EncInit(&rans);
+std::string BufferedRansEncoder::flush(uint32_t n_states) {
+  check_interleave(n_states);
 
-  std::vector<uint32_t> output(_syms.size(), 0xCC); // too much space ?
+  Rans64State rans[rans_max_interleave];
+  for (uint32_t k = 0; k < n_states; ++k) {
+    Rans64EncInit(&rans[k]);
+  }
+
+  std::vector<uint32_t> output(_syms.size() + 2 * n_states, 0xCC);
   uint32_t *ptr = output.data() + output.size();
   assert(ptr != nullptr);
 
+  /* Symbol i goes to state i % n_states, its bypass symbols stay on the same
+   * state. Walking backwards the bypass symbols come before their symbol. */
+  size_t i = _n_symbols;
   while (!_syms.empty()) {
     const RansSymbol sym = _syms.back();
+    Rans64State *r = &rans[(i - 1) & (n_states - 1)];
 
     if (!sym.bypass) {
-      Rans64EncPut(&rans, &ptr, sym.start, sym.range, precision);
+      Rans64EncPut(r, &ptr, sym.start, sym.range, precision);
+      --i;
     } else {
       // unlikely...
-      Rans64EncPutBits(&rans, &ptr, sym.start, bypass_precision);
+      Rans64EncPutBits(r, &ptr, sym.start, bypass_precision);
     }
     _syms.pop_back();
   }
+  _n_symbols = 0;
 
-  Rans64EncFlush(&rans, &ptr);
+  /* state 0 ends up first in the stream, as the decoder expects */
+  for (uint32_t k = n_states; k-- > 0;) {
+    Rans64EncFlush(&rans[k], &ptr);
+  }
 
   const int nbytes =
       std::distance(ptr, output.data() + output.size()) * sizeof(uint32_t);
   return std::string(reinterpret_cast<char *>(ptr), nbytes);
 }
 
+namespace {
+
+/* Number of bypass puts needed by the escaped symbols */
+inline size_t escape_puts(int32_t symbol, int32_t cdf_idx,
+                          const RansCdfTable &table) {
+  assert(cdf_idx >= 0 && cdf_idx < static_cast<int32_t>(table.size()));
+  const int32_t value = symbol - table.offsets[cdf_idx];
+  const int32_t max_value = table.cdfs_sizes[cdf_idx] - 2;
+  if (value < 0 || value >= max_value) {
+    return bypass_puts(escape_raw_value(value, max_value));
+  }
+  return 0;
+}
+
+/* Puts a symbol and its bypass bits, which come first as rANS encodes
+ * backwards */
+inline void Rans64EncPutSymbolWithTable(Rans64State *r, uint32_t **pptr,
+                                        int32_t symbol, int32_t cdf_idx,
+                                        const RansCdfTable &table) {
+  const int32_t max_value = table.cdfs_sizes[cdf_idx] - 2;
+
+  int32_t value = symbol - table.offsets[cdf_idx];
+  if (value < 0 || value >= max_value) {
+    // unlikely...
+    Rans64EncPutBypass(r, pptr, escape_raw_value(value, max_value));
+    value = max_value;
+  }
+  Rans64EncPutSymbol(r, pptr, table.enc_symbols(cdf_idx) + value, precision);
+}
+} // namespace
+
+uint32_t *DirectRansEncoder::begin(size_t n_puts, uint32_t n_states) {
+  check_interleave(n_states);
+
+  /* at most one word per rANS put, as in BufferedRansEncoder::flush */
+  const size_t n_words = n_puts + 2 * n_states;
+  if (_buffer.size() < n_words) {
+    _buffer.resize(n_words);
+  }
+  _end = _buffer.data() + n_words;
+
+  for (uint32_t k = 0; k < n_states; ++k) {
+    Rans64EncInit(&_rans[k]);
+  }
+  return _end;
+}
+
+std::string_view DirectRansEncoder::end(uint32_t *ptr, uint32_t n_states) {
+  /* state 0 ends up first in the stream, as the decoder expects */
+  for (uint32_t k = n_states; k-- > 0;) {
+    Rans64EncFlush(&_rans[k], &ptr);
+  }
+
+  return std::string_view(reinterpret_cast<const char *>(ptr),
+                          std::distance(ptr, _end) * sizeof(uint32_t));
+}
+
+std::string_view DirectRansEncoder::encode(const int32_t *symbols,
+                                           const int32_t *indexes, size_t size,
+                                           const RansCdfTable &table,
+                                           uint32_t n_states) {
+  size_t n_puts = size;
+  for (size_t i = 0; i < size; ++i) {
+    n_puts += escape_puts(symbols[i], indexes[i], table);
+  }
+  uint32_t *ptr = begin(n_puts, n_states);
+
+  /* symbol i goes to state i % n_states */
+  for (size_t i = size; i-- > 0;) {
+    Rans64EncPutSymbolWithTable(&_rans[i & (n_states - 1)], &ptr, symbols[i],
+                                indexes[i], table);
+  }
+
+  return end(ptr, n_states);
+}
+
+std::string_view DirectRansEncoder::encode_planes(const int32_t *symbols,
+                                                  size_t plane_size,
+                                                  int32_t first_cdf,
+                                                  int32_t n_planes,
+                                                  const RansCdfTable &table,
+                                                  uint32_t n_states,
+                                                  const uint8_t *skip) {
+  size_t size = 0;
+  size_t n_puts = 0;
+  for (int32_t p = 0; p < n_planes; ++p) {
+    if (skip && skip[p]) {
+      continue;
+    }
+    size += plane_size;
+    n_puts += plane_size;
+    const int32_t *plane = symbols + p * plane_size;
+    for (size_t j = 0; j < plane_size; ++j) {
+      n_puts += escape_puts(plane[j], first_cdf + p, table);
+    }
+  }
+  uint32_t *ptr = begin(n_puts, n_states);
+
+  /* same stream as encode() over the planes that are not skipped, with
+   * indexes[i] = first_cdf + p */
+  size_t i = size;
+  for (int32_t p = n_planes; p-- > 0;) {
+    if (skip && skip[p]) {
+      continue;
+    }
+    const int32_t cdf_idx = first_cdf + p;
+    const int32_t *plane = symbols + p * plane_size;
+    for (size_t j = plane_size; j-- > 0;) {
+      --i;
+      Rans64EncPutSymbolWithTable(&_rans[i & (n_states - 1)], &ptr,
+                                  plane[j], cdf_idx, table);
+    }
+  }
+
+  return end(ptr, n_states);
+}
+
+ChunkedRansEncoder::ChunkedRansEncoder(size_t chunk_symbols,
+                                       uint32_t n_states, ChunkSink sink)
+    : _chunk_symbols(chunk_symbols), _n_states(n_states),
+      _sink(std::move(sink)) {
+  check_interleave(n_states);
+  if (chunk_symbols == 0) {
+    throw std::invalid_argument("rANS chunk size must be positive");
+  }
+}
+
+void ChunkedRansEncoder::encode_with_indexes(
+    const std::vector<int32_t> &symbols, const std::vector<int32_t> &indexes,
+    const RansCdfTable &table) {
+  assert(symbols.size() == indexes.size());
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    if (_buffer.encode_symbol(symbols[i], indexes[i], table) >=
+        _chunk_symbols) {
+      flush_chunk();
+    }
+  }
+}
+
+void ChunkedRansEncoder::flush_chunk() {
+  const uint32_t n_symbols = static_cast<uint32_t>(_buffer.n_symbols());
+  if (n_symbols == 0) {
+    return;
+  }
+  const std::string data = _buffer.flush(_n_states);
+  const uint32_t n_bytes = static_cast<uint32_t>(data.size());
+
+  std::string *out = &_stream;
+  std::string chunk;
+  if (_sink) {
+    out = &chunk;
+  }
+  const size_t pos = out->size();
+  out->resize(pos + 2 * sizeof(uint32_t));
+  std::memcpy(&(*out)[pos], &n_symbols, sizeof(uint32_t));
+  std::memcpy(&(*out)[pos + sizeof(uint32_t)], &n_bytes, sizeof(uint32_t));
+  out->append(data);
+
+  if (_sink) {
+    _sink(chunk);
+  }
+}
+
+std::string ChunkedRansEncoder::flush() {
+  flush_chunk();
+  std::string stream;
+  stream.swap(_stream);
+  return stream;
+}
+
 std::string
 RansEncoder::encode_with_indexes(const std::vector<int32_t> &symbols,
                                  const std::vector<int32_t> &indexes,
@@ -222,6 +697,16 @@ RansEncoder::encode_with_indexes(const std::vector<int32_t> &symbols,
   return buffered_rans_enc.flush();
 }
 
+std::string RansEncoder::encode_with_indexes(const std::vector<int32_t> &symbols,
+                                             const std::vector<int32_t> &indexes,
+                                             const RansCdfTable &table,
+                                             uint32_t n_states) {
+  assert(symbols.size() == indexes.size());
+  DirectRansEncoder direct_rans_enc;
+  return std::string(direct_rans_enc.encode(symbols.data(), indexes.data(),
+                                            symbols.size(), table, n_states));
+}
+
 
 std::vector<int32_t>
 RansDecoder::decode_with_indexes(const std::string &encoded,
@@ -294,6 +779,110 @@ RansDecoder::decode_with_indexes(const std::string &encoded,
   return output;
 }
 
+std::vector<int32_t>
+RansDecoder::decode_with_indexes(const std::string &encoded,
+                                 const std::vector<int32_t> &indexes,
+                                 const RansCdfTable &table, uint32_t n_states) {
+  check_interleave(n_states);
+
+  std::vector<int32_t> output(indexes.size());
+
+  uint32_t *ptr = (uint32_t *)encoded.data();
+  assert(ptr != nullptr);
+
+  decode_interleaved(n_states, ptr, indexes.data(), indexes.size(), table,
+                     output.data());
+
+  return output;
+}
+
+std::vector<int32_t>
+RansDecoder::decode_chunked(const std::string &encoded,
+                            const std::vector<int32_t> &indexes,
+                            const RansCdfTable &table, uint32_t n_states) {
+  return decode_chunked(encoded.data(), encoded.size(), indexes, table,
+                        n_states);
+}
+
+std::vector<int32_t>
+RansDecoder::decode_chunked(const char *encoded, size_t size,
+                            const std::vector<int32_t> &indexes,
+                            const RansCdfTable &table, uint32_t n_states) {
+  check_interleave(n_states);
+
+  std::vector<int32_t> output(indexes.size());
+
+  constexpr size_t header_size = 2 * sizeof(uint32_t);
+  size_t pos = 0;
+  size_t i = 0;
+  while (pos < size) {
+    if (size - pos < header_size) {
+      throw std::runtime_error("Truncated chunked rANS stream");
+    }
+    uint32_t n_symbols = 0;
+    uint32_t n_bytes = 0;
+    std::memcpy(&n_symbols, encoded + pos, sizeof(uint32_t));
+    std::memcpy(&n_bytes, encoded + pos + sizeof(uint32_t),
+                sizeof(uint32_t));
+    pos += header_size;
+    if (n_bytes % sizeof(uint32_t) != 0 || n_bytes > size - pos ||
+        n_symbols > indexes.size() - i) {
+      throw std::runtime_error("Invalid chunked rANS stream");
+    }
+
+    uint32_t *ptr = (uint32_t *)(encoded + pos);
+    decode_interleaved(n_states, ptr, indexes.data() + i, n_symbols, table,
+                       output.data() + i);
+    pos += n_bytes;
+    i += n_symbols;
+  }
+  if (i != indexes.size()) {
+    throw std::runtime_error("Truncated chunked rANS stream");
+  }
+
+  return output;
+}
+
+void RansDecoder::decode_planes(const std::string &encoded, size_t plane_size,
+                                int32_t first_cdf, int32_t n_planes,
+                                const RansCdfTable &table, const float *bias,
+                                float *output, uint32_t n_states,
+                                const uint8_t *skip) {
+  decode_planes(encoded.data(), encoded.size(), plane_size, first_cdf,
+                n_planes, table, bias, output, n_states, skip);
+}
+
+void RansDecoder::decode_planes(const char *encoded, size_t size,
+                                size_t plane_size, int32_t first_cdf,
+                                int32_t n_planes, const RansCdfTable &table,
+                                const float *bias, float *output,
+                                uint32_t n_states, const uint8_t *skip) {
+  check_interleave(n_states);
+  assert(first_cdf >= 0 &&
+         first_cdf + n_planes <= static_cast<int32_t>(table.size()));
+
+  uint32_t *ptr = (uint32_t *)encoded;
+  assert(ptr != nullptr);
+
+  switch (n_states) {
+  case 1:
+    decode_planes_interleaved<1>(ptr, plane_size, first_cdf, n_planes, table,
+                                 bias, output, skip);
+    break;
+  case 2:
+    decode_planes_interleaved<2>(ptr, plane_size, first_cdf, n_planes, table,
+                                 bias, output, skip);
+    break;
+  case 4:
+    decode_planes_interleaved<4>(ptr, plane_size, first_cdf, n_planes, table,
+                                 bias, output, skip);
+    break;
+  case 8:
+    decode_planes_interleaved<8>(ptr, plane_size, first_cdf, n_planes, table,
+                                 bias, output, skip);
+    break;
+  }
+}
 
 void RansDecoder::set_stream(const std::string &encoded) {
   _stream = encoded;
@@ -368,4 +957,17 @@ RansDecoder::decode_stream(const std::vector<int32_t> &indexes,
   }
 
   return output;
-}
\ No newline at end of file
+}
+
+std::vector<int32_t> RansDecoder::decode_stream(const std::vector<int32_t> &indexes,
+                                                const RansCdfTable &table) {
+  std::vector<int32_t> output(indexes.size());
+
+  assert(_ptr != nullptr);
+
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    output[i] = Rans64DecSymbolWithTable(&_rans, &_ptr, indexes[i], table);
+  }
+
+  return output;
+}
@@ -0,0 +1,450 @@
+#include "rans_simd.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define ALIGNSPEC(type, name, alignment)                                       \
+  type name __attribute__((aligned(alignment)))
+#include "rans_word_sse41.h"
+
+#if defined(__AVX2__) && defined(CMPAI_RANS_AVX2)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/* probability range of the RansCdfTable cdfs */
+constexpr int precision = 16;
+
+/* Scales a `precision` bits cdf down to RANS_WORD_SCALE_BITS, every symbol
+ * keeps a frequency of at least 1 so it stays codable. */
+void requantize_cdf(const int32_t *cdf, int32_t cdf_size, uint16_t *start,
+                    uint16_t *freq) {
+  const int32_t n_syms = cdf_size - 1;
+  const int32_t shift = precision - RANS_WORD_SCALE_BITS;
+
+  int32_t total = 0;
+  for (int32_t s = 0; s < n_syms; ++s) {
+    const int32_t f = cdf[s + 1] - cdf[s];
+    freq[s] = static_cast<uint16_t>(
+        std::max(1, (f + (1 << (shift - 1))) >> shift));
+    total += freq[s];
+  }
+
+  /* fix the rounding error on the most probable symbols */
+  while (total > static_cast<int32_t>(RANS_WORD_M)) {
+    uint16_t *f = std::max_element(freq, freq + n_syms);
+    assert(*f > 1);
+    --*f;
+    --total;
+  }
+  if (total < static_cast<int32_t>(RANS_WORD_M)) {
+    int32_t best = 0;
+    for (int32_t s = 1; s < n_syms; ++s) {
+      if (cdf[s + 1] - cdf[s] > cdf[best + 1] - cdf[best]) {
+        best = s;
+      }
+    }
+    freq[best] = static_cast<uint16_t>(freq[best] + RANS_WORD_M - total);
+  }
+
+  uint32_t acc = 0;
+  for (int32_t s = 0; s < n_syms; ++s) {
+    start[s] = static_cast<uint16_t>(acc);
+    acc += freq[s];
+  }
+}
+
+/* Escaped values use the same mapping as the rans64 bypass mode */
+inline uint32_t escape_value(int32_t value, int32_t max_value) {
+  return value < 0 ? static_cast<uint32_t>(-2 * value - 1)
+                   : static_cast<uint32_t>(2 * (value - max_value));
+}
+
+inline int32_t unescape_value(uint32_t raw_val, int32_t max_value) {
+  const int32_t value = static_cast<int32_t>(raw_val >> 1);
+  return (raw_val & 1) ? -value - 1 : value + max_value;
+}
+
+void put_varint(std::string &out, uint32_t val) {
+  while (val >= 0x80) {
+    out.push_back(static_cast<char>((val & 0x7F) | 0x80));
+    val >>= 7;
+  }
+  out.push_back(static_cast<char>(val));
+}
+
+uint32_t get_varint(const uint8_t **pptr, const uint8_t *end) {
+  uint32_t val = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*pptr == end) {
+      throw std::runtime_error("Truncated SIMD rANS escape stream");
+    }
+    const uint8_t byte = *(*pptr)++;
+    val |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return val;
+    }
+  }
+  throw std::runtime_error("Invalid SIMD rANS escape stream");
+}
+
+/* Number of symbols of the step starting at i: up to rans_simd_lanes
+ * consecutive symbols with the same cdf index. */
+inline size_t step_size(const int32_t *indexes, size_t i, size_t size) {
+  if (i + rans_simd_lanes <= size) {
+    /* common case, written so that it vectorizes */
+    bool full = true;
+    for (uint32_t j = 1; j < rans_simd_lanes; ++j) {
+      full &= indexes[i + j] == indexes[i];
+    }
+    if (full) {
+      return rans_simd_lanes;
+    }
+  }
+  const size_t end = std::min(size, i + rans_simd_lanes);
+  size_t j = i + 1;
+  while (j < end && indexes[j] == indexes[i]) {
+    ++j;
+  }
+  return j - i;
+}
+
+#if defined(__AVX2__) && defined(CMPAI_RANS_AVX2)
+/* For every renormalization mask, the index of the word read by each lane:
+ * lanes needing a word read them in lane order. */
+struct RenormPermutation {
+  uint8_t idx[256][8];
+};
+
+constexpr RenormPermutation make_renorm_permutation() {
+  RenormPermutation p{};
+  for (int mask = 0; mask < 256; ++mask) {
+    uint8_t n = 0;
+    for (int j = 0; j < 8; ++j) {
+      p.idx[mask][j] = n;
+      n = static_cast<uint8_t>(n + ((mask >> j) & 1));
+    }
+  }
+  return p;
+}
+
+constexpr RenormPermutation renorm_permutation = make_renorm_permutation();
+
+/* All 8 lanes in one AVX2 register, same stream layout as two RansSimdDec.
+ * Opt-in (CMPAI_RANS_AVX2): the longer dependency chain per step makes it
+ * slower than the two SSE4.1 decoders on the cores measured so far. */
+struct LaneStates {
+  __m256i x;
+
+  void init(uint16_t **pptr) {
+    x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(*pptr));
+    *pptr += 2 * rans_simd_lanes;
+  }
+
+  void store(uint32_t *lanes) const {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), x);
+  }
+
+  void load(const uint32_t *lanes) {
+    x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lanes));
+  }
+
+  void decode(const RansWordTables *tab, uint16_t **pptr, int32_t *syms) {
+    alignas(32) uint32_t slots[rans_simd_lanes];
+    _mm256_store_si256(
+        reinterpret_cast<__m256i *>(slots),
+        _mm256_and_si256(x, _mm256_set1_epi32(RANS_WORD_M - 1)));
+
+    /* scalar loads beat vpgatherdd for 8 elements on most cores */
+    const __m256i freq_bias = _mm256_setr_epi32(
+        tab->slots[slots[0]].u32, tab->slots[slots[1]].u32,
+        tab->slots[slots[2]].u32, tab->slots[slots[3]].u32,
+        tab->slots[slots[4]].u32, tab->slots[slots[5]].u32,
+        tab->slots[slots[6]].u32, tab->slots[slots[7]].u32);
+    for (uint32_t j = 0; j < rans_simd_lanes; ++j) {
+      syms[j] = tab->slot2sym[slots[j]];
+    }
+
+    // s, x = D(x)
+    const __m256i freq =
+        _mm256_and_si256(freq_bias, _mm256_set1_epi32(0xffff));
+    const __m256i bias = _mm256_srli_epi32(freq_bias, 16);
+    x = _mm256_add_epi32(
+        _mm256_mullo_epi32(_mm256_srli_epi32(x, RANS_WORD_SCALE_BITS), freq),
+        bias);
+
+    // renormalize, reads up to 8 words past the current position
+    const __m256i x_biased = _mm256_xor_si256(
+        x, _mm256_set1_epi32(static_cast<int32_t>(0x80000000u)));
+    const __m256i greater = _mm256_cmpgt_epi32(
+        _mm256_set1_epi32(static_cast<int32_t>(RANS_WORD_L ^ 0x80000000u)),
+        x_biased);
+    const unsigned int mask = static_cast<unsigned int>(
+        _mm256_movemask_ps(_mm256_castsi256_ps(greater)));
+    const __m256i words = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(*pptr)));
+    const __m256i perm = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+        reinterpret_cast<const __m128i *>(renorm_permutation.idx[mask])));
+    const __m256i newx = _mm256_or_si256(
+        _mm256_slli_epi32(x, 16), _mm256_permutevar8x32_epi32(words, perm));
+    x = _mm256_blendv_epi8(x, newx, greater);
+    *pptr += __builtin_popcount(mask);
+  }
+};
+#elif defined(__SSE4_1__)
+/* Two 4-lane decoders of rans_word_sse41.h */
+struct LaneStates {
+  RansSimdDec r[2];
+
+  void init(uint16_t **pptr) {
+    RansSimdDecInit(&r[0], pptr);
+    RansSimdDecInit(&r[1], pptr);
+  }
+
+  void store(uint32_t *lanes) const {
+    std::memcpy(lanes, r[0].lane, sizeof(r[0].lane));
+    std::memcpy(lanes + 4, r[1].lane, sizeof(r[1].lane));
+  }
+
+  void load(const uint32_t *lanes) {
+    std::memcpy(r[0].lane, lanes, sizeof(r[0].lane));
+    std::memcpy(r[1].lane, lanes + 4, sizeof(r[1].lane));
+  }
+
+  void decode(const RansWordTables *tab, uint16_t **pptr, int32_t *syms) {
+    const uint32_t s0 = RansSimdDecSym(&r[0], tab);
+    const uint32_t s1 = RansSimdDecSym(&r[1], tab);
+    RansSimdDecRenorm(&r[0], pptr);
+    RansSimdDecRenorm(&r[1], pptr);
+    for (int j = 0; j < 4; ++j) {
+      syms[j] = (s0 >> (8 * j)) & 0xff;
+      syms[4 + j] = (s1 >> (8 * j)) & 0xff;
+    }
+  }
+};
+#else
+/* Portable fallback, decodes the same stream one lane at a time */
+struct LaneStates {
+  RansWordDec x[rans_simd_lanes];
+
+  void init(uint16_t **pptr) {
+    for (uint32_t j = 0; j < rans_simd_lanes; ++j) {
+      RansWordDecInit(&x[j], pptr);
+    }
+  }
+
+  void store(uint32_t *lanes) const { std::memcpy(lanes, x, sizeof(x)); }
+
+  void load(const uint32_t *lanes) { std::memcpy(x, lanes, sizeof(x)); }
+
+  void decode(const RansWordTables *tab, uint16_t **pptr, int32_t *syms) {
+    for (uint32_t j = 0; j < rans_simd_lanes; ++j) {
+      syms[j] = RansWordDecSym(&x[j], tab);
+      RansWordDecRenorm(&x[j], pptr);
+    }
+  }
+};
+#endif
+} // namespace
+
+RansSimdTable::RansSimdTable(const RansCdfTable &table) {
+  const size_t n = table.size();
+
+  for (size_t i = 0; i < n; ++i) {
+    const int32_t n_syms = table.cdfs_sizes[i] - 1;
+    /* a single symbol would need the full range, which RansWordSlot can't
+     * hold */
+    if (n_syms < 2 || n_syms > RANS_WORD_NSYMS) {
+      throw std::runtime_error("cdf " + std::to_string(i) +
+                               " is not supported by the SIMD rANS coder");
+    }
+    stride = std::max(stride, static_cast<size_t>(n_syms));
+  }
+
+  start.assign(n * stride, 0);
+  freq.assign(n * stride, 0);
+  max_values.resize(n);
+  offsets = table.offsets;
+
+  _tables.reset(new RansWordTables[n]);
+  for (size_t i = 0; i < n; ++i) {
+    const int32_t cdf_size = table.cdfs_sizes[i];
+    uint16_t *s_start = start.data() + i * stride;
+    uint16_t *s_freq = freq.data() + i * stride;
+    requantize_cdf(table.cdf_data(static_cast<int32_t>(i)), cdf_size, s_start,
+                   s_freq);
+
+    max_values[i] = cdf_size - 2;
+    for (int32_t s = 0; s < cdf_size - 1; ++s) {
+      RansWordTablesInitSymbol(&_tables[i], static_cast<uint8_t>(s),
+                               s_start[s], s_freq[s]);
+    }
+  }
+}
+
+RansSimdTable::~RansSimdTable() = default;
+
+const RansWordTables *RansSimdTable::tables(int32_t cdf_idx) const {
+  return &_tables[cdf_idx];
+}
+
+std::string
+RansSimdEncoder::encode_with_indexes(const std::vector<int32_t> &symbols,
+                                     const std::vector<int32_t> &indexes,
+                                     const RansSimdTable &table) {
+  assert(symbols.size() == indexes.size());
+  const size_t size = symbols.size();
+
+  /* forward pass: step sizes and escaped values in decoding order */
+  std::vector<uint8_t> steps;
+  steps.reserve(size / rans_simd_lanes + 1);
+  std::string escapes;
+  for (size_t i = 0; i < size;) {
+    const size_t n = step_size(indexes.data(), i, size);
+    const int32_t cdf_idx = indexes[i];
+    assert(cdf_idx >= 0 && cdf_idx < static_cast<int32_t>(table.size()));
+    const int32_t max_value = table.max_values[cdf_idx];
+    for (size_t j = i; j < i + n; ++j) {
+      const int32_t value = symbols[j] - table.offsets[cdf_idx];
+      if (value < 0 || value >= max_value) {
+        put_varint(escapes, escape_value(value, max_value));
+      }
+    }
+    steps.push_back(static_cast<uint8_t>(n));
+    i += n;
+  }
+
+  /* every symbol writes at most one word, plus the final states */
+  std::vector<uint16_t> output(size + 2 * rans_simd_lanes);
+  uint16_t *ptr = output.data() + output.size();
+
+  RansWordEnc rans[rans_simd_lanes];
+  for (uint32_t j = 0; j < rans_simd_lanes; ++j) {
+    rans[j] = RansWordEncInit();
+  }
+
+  /* backwards, lane j of a step holds its j-th symbol */
+  size_t i = size;
+  for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+    i -= *it;
+    const int32_t cdf_idx = indexes[i];
+    const int32_t max_value = table.max_values[cdf_idx];
+    const uint16_t *start = table.start.data() + cdf_idx * table.stride;
+    const uint16_t *freq = table.freq.data() + cdf_idx * table.stride;
+    for (size_t j = *it; j-- > 0;) {
+      int32_t value = symbols[i + j] - table.offsets[cdf_idx];
+      if (value < 0 || value >= max_value) {
+        value = max_value;
+      }
+      RansWordEncPut(&rans[j], &ptr, start[value], freq[value]);
+    }
+  }
+
+  /* lane 0 ends up first in the stream, as the decoder expects */
+  for (uint32_t j = rans_simd_lanes; j-- > 0;) {
+    RansWordEncFlush(&rans[j], &ptr);
+  }
+
+  const uint32_t nbytes = static_cast<uint32_t>(
+      std::distance(ptr, output.data() + output.size()) * sizeof(uint16_t));
+  std::string encoded(sizeof(uint32_t) + nbytes + escapes.size(), '\0');
+  std::memcpy(&encoded[0], &nbytes, sizeof(uint32_t));
+  std::memcpy(&encoded[sizeof(uint32_t)], ptr, nbytes);
+  if (!escapes.empty()) {
+    std::memcpy(&encoded[sizeof(uint32_t) + nbytes], escapes.data(),
+                escapes.size());
+  }
+  return encoded;
+}
+
+std::vector<int32_t>
+RansSimdDecoder::decode_with_indexes(const std::string &encoded,
+                                     const std::vector<int32_t> &indexes,
+                                     const RansSimdTable &table) {
+  return decode_with_indexes(encoded.data(), encoded.size(), indexes, table);
+}
+
+std::vector<int32_t>
+RansSimdDecoder::decode_with_indexes(const char *encoded, size_t encoded_size,
+                                     const std::vector<int32_t> &indexes,
+                                     const RansSimdTable &table) {
+  uint32_t nbytes = 0;
+  if (encoded_size < sizeof(uint32_t)) {
+    throw std::runtime_error("Truncated SIMD rANS stream");
+  }
+  std::memcpy(&nbytes, encoded, sizeof(uint32_t));
+  if (nbytes % 2 != 0 || nbytes < 4 * rans_simd_lanes ||
+      nbytes > encoded_size - sizeof(uint32_t)) {
+    throw std::runtime_error("Invalid SIMD rANS stream");
+  }
+
+  /* a step consumes at most 8 words and the SIMD renormalization reads 8
+   * words from ptr, so with 8 words of padding checking ptr against the end
+   * of the rANS words once per step keeps every read inside _words */
+  _words.assign(nbytes / 2 + 8, 0);
+  std::memcpy(_words.data(), encoded + sizeof(uint32_t), nbytes);
+  const uint8_t *esc = reinterpret_cast<const uint8_t *>(encoded) +
+                       sizeof(uint32_t) + nbytes;
+  const uint8_t *esc_end =
+      reinterpret_cast<const uint8_t *>(encoded) + encoded_size;
+
+  const size_t size = indexes.size();
+  std::vector<int32_t> output(size);
+
+  uint16_t *ptr = _words.data();
+  const uint16_t *words_end = _words.data() + nbytes / 2;
+  LaneStates states;
+  states.init(&ptr);
+
+  int32_t syms[rans_simd_lanes];
+  uint32_t lanes[rans_simd_lanes];
+  for (size_t i = 0; i < size;) {
+    if (ptr > words_end) {
+      throw std::runtime_error("Corrupted SIMD rANS stream");
+    }
+    const size_t n = step_size(indexes.data(), i, size);
+    const int32_t cdf_idx = indexes[i];
+    assert(cdf_idx >= 0 && cdf_idx < static_cast<int32_t>(table.size()));
+    const RansWordTables *tab = table.tables(cdf_idx);
+
+    if (n == rans_simd_lanes) {
+      states.decode(tab, &ptr, syms);
+    } else {
+      /* partial step (end of a run of indexes): only the first n lanes */
+      states.store(lanes);
+      for (size_t j = 0; j < n; ++j) {
+        syms[j] = RansWordDecSym(&lanes[j], tab);
+        RansWordDecRenorm(&lanes[j], &ptr);
+      }
+      states.load(lanes);
+    }
+
+    const int32_t max_value = table.max_values[cdf_idx];
+    const int32_t offset = table.offsets[cdf_idx];
+    bool escaped = false;
+    for (size_t j = 0; j < n; ++j) {
+      escaped |= syms[j] == max_value;
+      output[i + j] = syms[j] + offset;
+    }
+    if (escaped) {
+      for (size_t j = 0; j < n; ++j) {
+        if (syms[j] == max_value) {
+          output[i + j] =
+              unescape_value(get_varint(&esc, esc_end), max_value) + offset;
+        }
+      }
+    }
+    i += n;
+  }
+
+  if (ptr > words_end) {
+    throw std::runtime_error("Corrupted SIMD rANS stream");
+  }
+
+  return output;
+}
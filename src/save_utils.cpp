@@ -6,7 +6,9 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <stdexcept>
 #include "save_utils.h"
+#include "verbose.h"
 
 // 字节序转换函数（大端转小端或小端转大端）
 uint32_t swap_uint32(uint32_t val) {
@@ -97,6 +99,79 @@ void write_bytes(std::ofstream& file, const std::string& value) {
 }
 
 
+// 扩展头: model_id 最高位为 1 时, 在 output_cols 之后写入 [uint32 长度][扩展字段]
+// 读取时忽略不认识的尾部字段, 不带扩展头的文件与 CompressAI 完全一致
+constexpr unsigned char extension_flag = 0x80;
+// 扩展字段第 7 字节的标志位
+constexpr unsigned char skip_constant_channels_flag = 0x01;
+constexpr unsigned char minimal_padding_flag = 0x02;
+
+// 第 8 - 11 字节为 uint16 的 pad_top, pad_left, 第 12 - 13 字节为 uint16 的 spatial_tile
+void write_coding_options(std::ofstream& file, const CodingOptions& coding, uint32_t pad_top, uint32_t pad_left) {
+    if (pad_top > 0xffff || pad_left > 0xffff) {
+        throw std::runtime_error("padding does not fit in the header");
+    }
+    std::string ext;
+    ext.push_back(static_cast<char>(coding.rans_interleave));
+    ext.push_back(static_cast<char>(coding.entropy_coder));
+    ext.push_back(static_cast<char>(coding.n_substreams));
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        ext.push_back(static_cast<char>((coding.rans_chunk_symbols >> shift) & 0xff));
+    }
+    ext.push_back(static_cast<char>((coding.skip_constant_channels ? skip_constant_channels_flag : 0) |
+                                    (coding.minimal_padding ? minimal_padding_flag : 0)));
+    for (uint32_t pad : {pad_top, pad_left}) {
+        ext.push_back(static_cast<char>((pad >> 8) & 0xff));
+        ext.push_back(static_cast<char>(pad & 0xff));
+    }
+    ext.push_back(static_cast<char>((coding.spatial_tile >> 8) & 0xff));
+    ext.push_back(static_cast<char>(coding.spatial_tile & 0xff));
+    write_uint32(file, ext.size());
+    write_bytes(file, ext);
+}
+
+CodingOptions read_coding_options(std::ifstream& file, uint32_t& pad_top, uint32_t& pad_left) {
+    uint32_t ext_size = read_uint32(file);
+    std::string ext = read_bytes(file, ext_size);
+    CodingOptions coding;
+    if (ext.size() >= 1) {
+        coding.rans_interleave = static_cast<uint8_t>(ext[0]);
+    }
+    if (ext.size() >= 2) {
+        if (static_cast<uint8_t>(ext[1]) > static_cast<uint8_t>(EntropyCoder::RansSimd)) {
+            throw std::runtime_error("unknown entropy coder " + std::to_string(static_cast<uint8_t>(ext[1])));
+        }
+        coding.entropy_coder = static_cast<EntropyCoder>(ext[1]);
+    }
+    if (ext.size() >= 3) {
+        coding.n_substreams = static_cast<uint8_t>(ext[2]);
+        if (coding.n_substreams == 0) {
+            throw std::runtime_error("invalid number of substreams 0");
+        }
+    }
+    if (ext.size() >= 7) {
+        coding.rans_chunk_symbols = 0;
+        for (int i = 3; i < 7; i++) {
+            coding.rans_chunk_symbols = (coding.rans_chunk_symbols << 8) | static_cast<uint8_t>(ext[i]);
+        }
+    }
+    if (ext.size() >= 8) {
+        coding.skip_constant_channels = static_cast<uint8_t>(ext[7]) & skip_constant_channels_flag;
+        coding.minimal_padding = static_cast<uint8_t>(ext[7]) & minimal_padding_flag;
+    }
+    if (ext.size() >= 12) {
+        pad_top = (static_cast<uint32_t>(static_cast<uint8_t>(ext[8])) << 8) | static_cast<uint8_t>(ext[9]);
+        pad_left = (static_cast<uint32_t>(static_cast<uint8_t>(ext[10])) << 8) | static_cast<uint8_t>(ext[11]);
+    } else if (coding.minimal_padding) {
+        throw std::runtime_error("minimal padding without padding fields");
+    }
+    if (ext.size() >= 14) {
+        coding.spatial_tile = static_cast<uint16_t>((static_cast<uint8_t>(ext[12]) << 8) | static_cast<uint8_t>(ext[13]));
+    }
+    return coding;
+}
+
+
 void parse_code(char code, char& quality, char& metric) {
     quality = (code & 0x0F) + 1;
     metric = code >> 4;
@@ -104,7 +179,9 @@ void parse_code(char code, char& quality, char& metric) {
 
 void build_code(char metric, char quality, char& code) {
     code = (metric << 4) | ((quality - 1) & 0x0F);
-    std::cout << "    metric: " << static_cast<int>(metric) << " code: " << static_cast<int>(code) << std::endl;
+    if (verbose()) {
+        std::cout << "    metric: " << static_cast<int>(metric) << " code: " << static_cast<int>(code) << std::endl;
+    }
 }
 
 fileInfo load(const std::string& filename) {
@@ -117,6 +194,8 @@ fileInfo load(const std::string& filename) {
 
     // 读取header
     char model_id = read_uchar(file);
+    bool has_extension = static_cast<unsigned char>(model_id) & extension_flag;
+    model_id = static_cast<char>(model_id & ~extension_flag);
     char code = read_uchar(file);
     char quality, metric;
     parse_code(code, quality, metric);
@@ -125,23 +204,39 @@ fileInfo load(const std::string& filename) {
     uint32_t original_bitdepth = read_uchar(file);
     uint32_t output_rows = read_uint32(file);
     uint32_t output_cols = read_uint32(file);
+    CodingOptions coding;
+    uint32_t pad_top = 0;
+    uint32_t pad_left = 0;
+    if (has_extension) {
+        coding = read_coding_options(file, pad_top, pad_left);
+    }
     uint32_t n_strings = read_uint32(file);
 
     std::string model_name = inverse_model_ids[model_id];
     std::string metric_name = inverse_metric_ids[metric];
 
-    std::cout << "model_id: " << static_cast<int>(model_id) << std::endl;
-    std::cout << "code: " << static_cast<int>(code) << std::endl;
-    std::cout << "quality: " << static_cast<int>(quality) << std::endl;
-    std::cout << "metric: " << static_cast<int>(metric) << std::endl;
-    std::cout << "model_name: " << model_name << std::endl;
-    std::cout << "metric_name: " << metric_name << std::endl;
-    std::cout << "original_height: " << original_height << std::endl;
-    std::cout << "original_width: " << original_width << std::endl;
-    std::cout << "output_rows: " << output_rows << std::endl;
-    std::cout << "output_cols: " << output_cols << std::endl;
-    std::cout << "original_bitdepth: " << original_bitdepth << std::endl;
-    std::cout << "n_strings: " << n_strings << std::endl;
+    if (verbose()) {
+        std::cout << "model_id: " << static_cast<int>(model_id) << std::endl;
+        std::cout << "code: " << static_cast<int>(code) << std::endl;
+        std::cout << "quality: " << static_cast<int>(quality) << std::endl;
+        std::cout << "metric: " << static_cast<int>(metric) << std::endl;
+        std::cout << "model_name: " << model_name << std::endl;
+        std::cout << "metric_name: " << metric_name << std::endl;
+        std::cout << "original_height: " << original_height << std::endl;
+        std::cout << "original_width: " << original_width << std::endl;
+        std::cout << "output_rows: " << output_rows << std::endl;
+        std::cout << "output_cols: " << output_cols << std::endl;
+        std::cout << "original_bitdepth: " << original_bitdepth << std::endl;
+        std::cout << "n_strings: " << n_strings << std::endl;
+        std::cout << "rans_interleave: " << static_cast<int>(coding.rans_interleave) << std::endl;
+        std::cout << "entropy_coder: " << static_cast<int>(coding.entropy_coder) << std::endl;
+        std::cout << "n_substreams: " << static_cast<int>(coding.n_substreams) << std::endl;
+        std::cout << "rans_chunk_symbols: " << coding.rans_chunk_symbols << std::endl;
+        std::cout << "skip_constant_channels: " << coding.skip_constant_channels << std::endl;
+        std::cout << "minimal_padding: " << coding.minimal_padding << std::endl;
+        std::cout << "pad_top: " << pad_top << " pad_left: " << pad_left << std::endl;
+        std::cout << "spatial_tile: " << coding.spatial_tile << std::endl;
+    }
 
     std::vector<std::string> strings;
     std::vector<uint32_t> length_strings;
@@ -151,11 +246,13 @@ fileInfo load(const std::string& filename) {
         length_strings.push_back(length);
         strings.push_back(string);
     }
-    std::cout << "strings length: [";
-    for (size_t i = 0; i < n_strings; i++) {
-        std::cout << length_strings[i] << ",";
+    if (verbose()) {
+        std::cout << "strings length: [";
+        for (size_t i = 0; i < n_strings; i++) {
+            std::cout << length_strings[i] << ",";
+        }
+        std::cout << "]" << std::endl;
     }
-    std::cout << "]" << std::endl;
 
     file.close();
 
@@ -173,7 +270,10 @@ fileInfo load(const std::string& filename) {
         output_cols,
         n_strings,
         length_strings,
-        strings
+        strings,
+        coding,
+        pad_top,
+        pad_left
     };
 
     return info;
@@ -187,27 +287,41 @@ void save(const fileInfo& info, const std::string& output_path) {
         return;
     }
 
-    std::cout << "info.model_id: " << static_cast<int>(info.model_id) << std::endl;
-    std::cout << "info.code: " << static_cast<int>(info.code) << std::endl;
-    std::cout << "info.original_height: " << info.original_height << std::endl;
-    std::cout << "info.original_width: " << info.original_width << std::endl;
-    std::cout << "info.original_bitdepth: " << static_cast<int>(info.original_bitdepth) << std::endl;
-    std::cout << "info.output_rows: " << info.output_rows << std::endl;
-    std::cout << "info.output_cols: " << info.output_cols << std::endl;
-    std::cout << "info.n_strings: " << info.n_strings << std::endl;
-    std::cout << "info.length_strings: [";
-    for (size_t i = 0; i < info.n_strings; i++) {
-        std::cout << info.length_strings[i] << ",";
+    if (verbose()) {
+        std::cout << "info.model_id: " << static_cast<int>(info.model_id) << std::endl;
+        std::cout << "info.code: " << static_cast<int>(info.code) << std::endl;
+        std::cout << "info.original_height: " << info.original_height << std::endl;
+        std::cout << "info.original_width: " << info.original_width << std::endl;
+        std::cout << "info.original_bitdepth: " << static_cast<int>(info.original_bitdepth) << std::endl;
+        std::cout << "info.output_rows: " << info.output_rows << std::endl;
+        std::cout << "info.output_cols: " << info.output_cols << std::endl;
+        std::cout << "info.n_strings: " << info.n_strings << std::endl;
+        std::cout << "info.length_strings: [";
+        for (size_t i = 0; i < info.n_strings; i++) {
+            std::cout << info.length_strings[i] << ",";
+        }
+        std::cout << "]" << std::endl;
+        std::cout << "info.rans_interleave: " << static_cast<int>(info.coding.rans_interleave) << std::endl;
+        std::cout << "info.entropy_coder: " << static_cast<int>(info.coding.entropy_coder) << std::endl;
+        std::cout << "info.n_substreams: " << static_cast<int>(info.coding.n_substreams) << std::endl;
+        std::cout << "info.rans_chunk_symbols: " << info.coding.rans_chunk_symbols << std::endl;
+        std::cout << "info.skip_constant_channels: " << info.coding.skip_constant_channels << std::endl;
+        std::cout << "info.minimal_padding: " << info.coding.minimal_padding << std::endl;
+        std::cout << "info.spatial_tile: " << info.coding.spatial_tile << std::endl;
     }
-    std::cout << "]" << std::endl;
 
-    write_uchar(file, info.model_id);
+    bool has_extension = !info.coding.compressai_compatible();
+
+    write_uchar(file, has_extension ? static_cast<char>(info.model_id | extension_flag) : info.model_id);
     write_uchar(file, info.code);
     write_uint32(file, info.original_height);
     write_uint32(file, info.original_width);
     write_uchar(file, info.original_bitdepth);
     write_uint32(file, info.output_rows);
     write_uint32(file, info.output_cols);
+    if (has_extension) {
+        write_coding_options(file, info.coding, info.pad_top, info.pad_left);
+    }
     write_uint32(file, info.n_strings);
     for (size_t i = 0; i < info.n_strings; i++) {
         write_uint32(file, info.length_strings[i]);
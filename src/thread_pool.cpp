@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t n_threads) {
+    if (n_threads == 0) {
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers_.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; i++) {
+        workers_.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+            if (stop_ && jobs_.empty()) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop();
+        }
+        job();
+    }
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+    if (n == 0) {
+        return;
+    }
+    if (n == 1) {
+        fn(0);
+        return;
+    }
+
+    // 所有执行者从同一个计数器领取下标, 调用线程也领取, 所以嵌套调用不会死锁
+    struct State {
+        std::atomic<size_t> next{0};
+        size_t done = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+    auto state = std::make_shared<State>();
+
+    auto run = [state, n, &fn]() {
+        size_t finished = 0;
+        for (size_t i = state->next++; i < n; i = state->next++) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error) {
+                    state->error = std::current_exception();
+                }
+            }
+            finished++;
+        }
+        if (finished > 0) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->done += finished;
+            if (state->done == n) {
+                state->cv.notify_all();
+            }
+        }
+    };
+
+    const size_t n_helpers = std::min(n - 1, workers_.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < n_helpers; i++) {
+            jobs_.push(run);
+        }
+    }
+    cv_.notify_all();
+
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&state, n]() { return state->done == n; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
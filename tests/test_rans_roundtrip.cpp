@@ -0,0 +1,228 @@
+// 各种 rANS 编码方式的往返测试: 交织, SIMD, 分段, 常数通道, 空间分块
+// 用法: test_rans_roundtrip <entropy_bottleneck.npz>
+#include "entropy_bottleneck.h"
+#include "rans_interface.hpp"
+#include "rans_simd.hpp"
+#include "test_utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+// 随机的 16 位量化 cdf, lengths 为每个 cdf 的长度 (最后一个符号为 escape)
+RansCdfTable random_table(const std::vector<int32_t>& lengths, std::mt19937& rng) {
+    std::vector<std::vector<int32_t>> cdfs;
+    std::vector<int32_t> offsets;
+    for (int32_t length : lengths) {
+        const int32_t n_symbols = length - 1;
+        std::vector<double> weights(n_symbols);
+        std::exponential_distribution<double> exponential(1.0);
+        for (double& w : weights) {
+            w = exponential(rng);
+        }
+        const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+        // 每个符号至少 1, 剩余的按权重分配, 舍入误差补到最大的符号上
+        const int32_t budget = (1 << 16) - n_symbols;
+        std::vector<int32_t> freqs(n_symbols);
+        int32_t used = 0;
+        for (int32_t s = 0; s < n_symbols; s++) {
+            freqs[s] = 1 + static_cast<int32_t>(weights[s] / total * budget);
+            used += freqs[s];
+        }
+        *std::max_element(freqs.begin(), freqs.end()) += (1 << 16) - used;
+
+        std::vector<int32_t> cdf(length, 0);
+        for (int32_t s = 0; s < n_symbols; s++) {
+            cdf[s + 1] = cdf[s] + freqs[s];
+        }
+        cdfs.push_back(cdf);
+        offsets.push_back(-(length - 2) / 2);
+    }
+    return RansCdfTable(cdfs, lengths, offsets);
+}
+
+// 大部分符号在 cdf 的范围内, escape_rate 的符号远离范围, 需要 escape 编码
+int32_t random_symbol(const RansCdfTable& table, int32_t cdf_idx, double escape_rate, std::mt19937& rng) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const int32_t max_value = table.cdfs_sizes[cdf_idx] - 2;
+    if (uniform(rng) < escape_rate) {
+        const int32_t far[] = {-1, max_value, max_value + 1, -70000, 123456, -(1 << 20), 1 << 24};
+        return table.offsets[cdf_idx] + far[rng() % (sizeof(far) / sizeof(far[0]))];
+    }
+    return table.offsets[cdf_idx] + static_cast<int32_t>(rng() % std::max(1, max_value));
+}
+
+// 交织 1 / 2 / 4 / 8 路: 逐符号索引和按平面两种接口, BufferedRansEncoder 与 DirectRansEncoder 的码流相同
+void test_interleaved(const RansCdfTable& table, std::mt19937& rng) {
+    const int32_t n_planes = static_cast<int32_t>(table.size());
+    for (size_t plane : {size_t(1), size_t(7), size_t(37), size_t(256)}) {
+        std::vector<int32_t> symbols(plane * n_planes);
+        std::vector<int32_t> indexes(plane * n_planes);
+        std::vector<uint8_t> skip(n_planes, 0);
+        for (int32_t p = 0; p < n_planes; p++) {
+            skip[p] = p % 3 == 1;
+            for (size_t i = 0; i < plane; i++) {
+                symbols[p * plane + i] = random_symbol(table, p, 0.03, rng);
+                indexes[p * plane + i] = p;
+            }
+        }
+
+        for (uint32_t n_states : {1u, 2u, 4u, 8u}) {
+            DirectRansEncoder direct;
+            const std::string by_index(direct.encode(symbols.data(), indexes.data(), symbols.size(), table, n_states));
+
+            BufferedRansEncoder buffered;
+            for (size_t i = 0; i < symbols.size(); i++) {
+                buffered.encode_symbol(symbols[i], indexes[i], table);
+            }
+            CHECK(buffered.flush(n_states) == by_index);
+
+            RansDecoder decoder;
+            CHECK(decoder.decode_with_indexes(by_index, indexes, table, n_states) == symbols);
+
+            // 按平面编码, 跳过的平面不进入码流, 解码时保持原值
+            const std::string by_plane(
+                direct.encode_planes(symbols.data(), plane, 0, n_planes, table, n_states, skip.data()));
+            const std::vector<float> bias(n_planes, 0.0f);
+            std::vector<float> decoded(symbols.size(), -0.5f);
+            decoder.decode_planes(by_plane, plane, 0, n_planes, table, bias.data(), decoded.data(), n_states,
+                                  skip.data());
+            bool same = true;
+            for (int32_t p = 0; p < n_planes; p++) {
+                for (size_t i = 0; i < plane; i++) {
+                    const float expected = skip[p] ? -0.5f : static_cast<float>(symbols[p * plane + i]);
+                    same &= decoded[p * plane + i] == expected;
+                }
+            }
+            CHECK(same);
+        }
+    }
+}
+
+// 分段编码: 段长为 1, 不整除总数, 恰好等于总数和大于总数
+void test_chunked(const RansCdfTable& table, std::mt19937& rng) {
+    const size_t size = 1000;
+    std::vector<int32_t> symbols(size);
+    std::vector<int32_t> indexes(size);
+    for (size_t i = 0; i < size; i++) {
+        indexes[i] = static_cast<int32_t>(rng() % table.size());
+        symbols[i] = random_symbol(table, indexes[i], 0.02, rng);
+    }
+    for (size_t chunk : {size_t(1), size_t(7), size_t(64), size, size + 5}) {
+        for (uint32_t n_states : {1u, 4u}) {
+            ChunkedRansEncoder encoder(chunk, n_states);
+            encoder.encode_with_indexes(symbols, indexes, table);
+            const std::string encoded = encoder.flush();
+            RansDecoder decoder;
+            CHECK(decoder.decode_chunked(encoded, indexes, table, n_states) == symbols);
+
+            // 截断的码流必须报错而不是越界读取
+            bool threw = false;
+            try {
+                decoder.decode_chunked(encoded.substr(0, encoded.size() - 3), indexes, table, n_states);
+            } catch (const std::runtime_error&) {
+                threw = true;
+            }
+            CHECK(threw);
+        }
+    }
+}
+
+// SIMD 编码: 同一 cdf 的连续符号不满 8 个的步, 最后不完整的一步, escape
+void test_simd(const RansCdfTable& table, std::mt19937& rng) {
+    RansSimdTable simd_table(table);
+    for (size_t size : {size_t(1), size_t(8), size_t(13), size_t(8 * 64 + 3), size_t(5000)}) {
+        std::vector<int32_t> symbols(size);
+        std::vector<int32_t> indexes(size);
+        int32_t idx = 0;
+        for (size_t i = 0; i < size; i++) {
+            // 平均每 20 个符号换一个 cdf, 产生大量不满 8 个符号的步
+            if (rng() % 20 == 0) {
+                idx = static_cast<int32_t>(rng() % table.size());
+            }
+            indexes[i] = idx;
+            symbols[i] = random_symbol(table, idx, 0.02, rng);
+        }
+        RansSimdEncoder encoder;
+        const std::string encoded = encoder.encode_with_indexes(symbols, indexes, simd_table);
+        RansSimdDecoder decoder;
+        CHECK(decoder.decode_with_indexes(encoded, indexes, simd_table) == symbols);
+
+        // 带前缀的缓冲中原地解码
+        const std::string prefixed = "abc" + encoded;
+        CHECK(decoder.decode_with_indexes(prefixed.data() + 3, encoded.size(), indexes, simd_table) == symbols);
+    }
+}
+
+// EntropyBottleNeck 的各种编码选项都必须解码出与默认选项相同的结果, 且与输入相差不超过量化误差
+void test_entropy_bottleneck(EntropyBottleNeck& eb, std::mt19937& rng) {
+    const int N = 2;
+    const int C = eb.channels();
+    // 13 x 21 不被任何块大小整除
+    const int H = 13;
+    const int W = 21;
+    const std::vector<float> y = random_latent(N, C, H, W, rng, true);
+    const std::vector<int> shape = {N, C, H, W};
+
+    const CodingOptions reference_coding;
+    std::vector<float> reference(y.size());
+    eb.decompress(eb.compress(y.data(), shape, reference_coding), {H, W}, reference.data(), reference_coding);
+    bool close = true;
+    for (size_t i = 0; i < y.size(); i++) {
+        close &= std::fabs(reference[i] - y[i]) <= 0.5f + 1e-3f * std::fabs(y[i]);
+    }
+    CHECK(close);
+
+    for (int substreams : {1, 5, C}) {  // 5 不整除 C, C 时每个子码流一个通道
+        for (int variant = 0; variant < 6; variant++) {
+            CodingOptions coding;
+            coding.n_substreams = static_cast<uint8_t>(std::min(substreams, 255));
+            switch (variant) {
+                case 0: coding.rans_interleave = 8; break;
+                case 1: coding.entropy_coder = EntropyCoder::RansSimd; break;
+                case 2: coding.rans_chunk_symbols = 97; coding.rans_interleave = 2; break;
+                case 3: coding.skip_constant_channels = true; coding.rans_interleave = 4; break;
+                case 4: coding.skip_constant_channels = true; coding.entropy_coder = EntropyCoder::RansSimd; break;
+                case 5: coding.skip_constant_channels = true; coding.rans_chunk_symbols = 50; break;
+            }
+            for (uint16_t tile : {uint16_t(0), uint16_t(4), uint16_t(5)}) {
+                coding.spatial_tile = tile;
+                const std::vector<std::string> strings = eb.compress(y.data(), shape, coding);
+                std::vector<float> decoded(y.size(), 0.0f);
+                eb.decompress(strings, {H, W}, decoded.data(), coding);
+                CHECK(decoded == reference);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <entropy_bottleneck.npz>\n", argv[0]);
+        return 2;
+    }
+    std::mt19937 rng(20240601u);
+
+    // 长度不超过 RansCdfTable::linear_search_max 的 cdf 走线性查找, 其余走查找表
+    // 长度为 3 时只有一个普通符号和 escape
+    const RansCdfTable table = random_table({3, 4, 6, 8, 9, 17, 40, 120}, rng);
+    test_interleaved(table, rng);
+    test_chunked(table, rng);
+    test_simd(table, rng);
+
+    EntropyBottleNeck eb(argv[1]);
+    test_entropy_bottleneck(eb, rng);
+
+    if (failures > 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("test_rans_roundtrip passed\n");
+    return 0;
+}
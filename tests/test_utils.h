@@ -0,0 +1,39 @@
+#pragma once
+// 测试共用的检查宏和随机潜变量
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// 失败的检查数, 每个测试可执行文件一份
+inline int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::fprintf(stderr, "%s:%d: CHECK(%s)\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+// [N, C, H, W] 的潜变量, 大部分取值在中位数附近, 少数远离以覆盖 escape
+// constant_channels 时部分通道为常数 (其中一些整组子码流都是常数), 覆盖 skip_constant_channels
+inline std::vector<float> random_latent(int N, int C, int H, int W, std::mt19937& rng, bool constant_channels) {
+    std::normal_distribution<float> normal(0.0f, 2.0f);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> y(static_cast<size_t>(N) * C * H * W);
+    const size_t plane = static_cast<size_t>(H) * W;
+    for (int n = 0; n < N; n++) {
+        for (int c = 0; c < C; c++) {
+            float* p = y.data() + (static_cast<size_t>(n) * C + c) * plane;
+            if (constant_channels && (c % 4 == 0 || c < 16)) {
+                std::fill_n(p, plane, static_cast<float>(c % 7) - 3.2f);
+                continue;
+            }
+            for (size_t i = 0; i < plane; i++) {
+                p[i] = uniform(rng) < 0.002f ? normal(rng) * 300.0f : normal(rng);
+            }
+        }
+    }
+    return y;
+}
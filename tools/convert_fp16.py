@@ -0,0 +1,79 @@
+"""把 g_a / g_s 转换为 FP16 模型, 供 cmpai-cli --precision fp16 使用
+
+用法:
+    python tools/convert_fp16.py --model-dir ./models
+
+权重、激活以及输入输出都转换为 float16, C++ 端在 run 中用 F16C 指令与 float32 互相转换.
+GDN / IGDN 的 x^2 -> 1x1 卷积 -> sqrt -> 乘除 保留 float32: beta + sum(gamma * x^2) 对 192 个通道求和,
+|x| 稍大时就超出 float16 的范围 (65504).
+转换后必须用 `cmpai-cli eval <image> --precision fp16` 检查 PSNR / bpp 的变化.
+"""
+import argparse
+import os
+
+import onnx
+import onnx.numpy_helper
+from onnxconverter_common import float16
+
+
+def gdn_nodes(graph):
+    """GDN / IGDN 的节点名: 从 x^2 (Pow(x, 2) 或 Mul(x, x)) 沿输出向后, 直到再次使用 x 的乘除节点"""
+    constants = {init.name: onnx.numpy_helper.to_array(init) for init in graph.initializer}
+    for node in graph.node:
+        if node.op_type == "Constant" and node.attribute[0].name == "value":
+            constants[node.output[0]] = onnx.numpy_helper.to_array(node.attribute[0].t)
+    consumers = {}
+    for node in graph.node:
+        for name in node.input:
+            consumers.setdefault(name, []).append(node)
+
+    blocked = set()
+    for node in graph.node:
+        if node.op_type == "Mul" and len(node.input) == 2 and node.input[0] == node.input[1]:
+            x = node.input[0]
+        elif node.op_type == "Pow" and node.input[1] in constants and float(constants[node.input[1]]) == 2.0:
+            x = node.input[0]
+        else:
+            continue
+        # GDN 内部只有几个节点, 超过 8 层还没回到 x 说明不是 GDN
+        path = [node]
+        frontier = list(node.output)
+        for _ in range(8):
+            nexts = [n for name in frontier for n in consumers.get(name, [])]
+            if len(nexts) != 1:
+                break
+            path.append(nexts[0])
+            if x in nexts[0].input:
+                blocked.update(n.name for n in path)
+                break
+            frontier = list(nexts[0].output)
+    return sorted(blocked)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--model-dir", default="./models")
+    parser.add_argument("--model", default="bmshj2018-factorized")
+    parser.add_argument("--metric", default="mse")
+    parser.add_argument("--quality", default="3")
+    parser.add_argument("--keep-io-types", action="store_true", help="keep float32 input and output")
+    args = parser.parse_args()
+
+    prefix = os.path.join(args.model_dir, "%s-%s-q%s-" % (args.model, args.metric, args.quality))
+    for network in ("g_a", "g_s"):
+        model = onnx.load(prefix + network + ".onnx")
+        # node_block_list 按节点名匹配, 导出的模型可能有未命名的节点
+        for i, node in enumerate(model.graph.node):
+            if not node.name:
+                node.name = "%s_%d" % (node.op_type, i)
+        blocked = gdn_nodes(model.graph)
+        if not blocked:
+            raise RuntimeError("no GDN found in " + network + ", refusing to convert it to float16 blindly")
+        print("%s: keep %d GDN nodes in float32" % (network, len(blocked)))
+        model = float16.convert_float_to_float16(model, keep_io_types=args.keep_io_types, node_block_list=blocked)
+        onnx.save(model, prefix + network + ".fp16.onnx")
+        print("wrote", prefix + network + ".fp16.onnx")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,112 @@
+"""生成 g_a / g_s 的 INT8 (QDQ) 模型, 供 cmpai-cli --precision int8 使用
+
+用法:
+    python tools/quantize_int8.py --model-dir ./models --calib-dir /path/to/images
+
+只量化 Conv / ConvTranspose 的权重和激活, GDN 的平方/开方运算保持 float,
+输入输出仍为 float32, C++ 端的前后处理不需要改动.
+量化后用 `cmpai-cli eval <image> --precision int8` 检查 PSNR / bpp 是否在允许范围内.
+"""
+import argparse
+import glob
+import os
+import random
+
+import numpy as np
+import onnxruntime as ort
+from onnxruntime.quantization import (CalibrationDataReader, CalibrationMethod, QuantFormat, QuantType,
+                                      quantize_static)
+from PIL import Image
+
+
+def pad4d(x):
+    # 与 C++ 端 pad_before / padded_size 一致: 两侧各补 (补到 64 的倍数所差的像素) / 2,
+    # 差值为奇数时总共少补一个像素, 结果不是 64 的倍数 (例如 63 不补)
+    _, _, h, w = x.shape
+    ph = ((h + 63) // 64 * 64 - h) // 2
+    pw = ((w + 63) // 64 * 64 - w) // 2
+    return np.pad(x, ((0, 0), (0, 0), (ph, ph), (pw, pw)))
+
+
+def load_crops(calib_dir, n_samples, crop, seed):
+    paths = sorted(p for ext in ("png", "jpg", "jpeg", "bmp") for p in glob.glob(os.path.join(calib_dir, "*." + ext)))
+    if not paths:
+        raise SystemExit("no images found in " + calib_dir)
+    rng = random.Random(seed)
+    crops = []
+    for i in range(n_samples):
+        image = np.asarray(Image.open(paths[i % len(paths)]).convert("RGB"), dtype=np.float32) / 255.0
+        h, w, _ = image.shape
+        top = rng.randint(0, max(h - crop, 0))
+        left = rng.randint(0, max(w - crop, 0))
+        patch = image[top:top + crop, left:left + crop].transpose(2, 0, 1)[None]
+        crops.append(pad4d(np.ascontiguousarray(patch)))
+    return crops
+
+
+class ListReader(CalibrationDataReader):
+    def __init__(self, input_name, samples):
+        self.input_name = input_name
+        self.samples = iter(samples)
+
+    def get_next(self):
+        sample = next(self.samples, None)
+        return None if sample is None else {self.input_name: sample}
+
+
+def input_name(path):
+    return ort.InferenceSession(path, providers=["CPUExecutionProvider"]).get_inputs()[0].name
+
+
+def quantize(src, dst, samples, args):
+    quantize_static(
+        src,
+        dst,
+        ListReader(input_name(src), samples),
+        quant_format=QuantFormat.QDQ,
+        op_types_to_quantize=args.op_types.split(","),
+        per_channel=True,
+        reduce_range=args.reduce_range,
+        activation_type=QuantType.QUInt8,
+        weight_type=QuantType.QInt8,
+        calibrate_method={
+            "minmax": CalibrationMethod.MinMax,
+            "entropy": CalibrationMethod.Entropy,
+            "percentile": CalibrationMethod.Percentile,
+        }[args.calibration],
+    )
+    print("wrote", dst)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--model-dir", default="./models")
+    parser.add_argument("--model", default="bmshj2018-factorized")
+    parser.add_argument("--metric", default="mse")
+    parser.add_argument("--quality", default="3")
+    parser.add_argument("--calib-dir", required=True, help="directory of calibration images")
+    parser.add_argument("--samples", type=int, default=64)
+    parser.add_argument("--crop", type=int, default=256)
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--calibration", choices=["minmax", "entropy", "percentile"], default="percentile")
+    parser.add_argument("--op-types", default="Conv,ConvTranspose")
+    parser.add_argument("--reduce-range", action="store_true", help="7-bit weights, for CPUs without VNNI")
+    args = parser.parse_args()
+
+    prefix = os.path.join(args.model_dir, "%s-%s-q%s-" % (args.model, args.metric, args.quality))
+    crops = load_crops(args.calib_dir, args.samples, args.crop, args.seed)
+
+    quantize(prefix + "g_a.onnx", prefix + "g_a.int8.onnx", crops, args)
+
+    # g_s 的校准数据为 FP32 g_a 的输出按中值量化后的 y_hat, 与解码时的输入分布一致
+    g_a = ort.InferenceSession(prefix + "g_a.onnx", providers=["CPUExecutionProvider"])
+    medians = np.load(prefix + "entropy_bottleneck.npz")["quantiles"][:, 0, 1].reshape(1, -1, 1, 1)
+    latents = []
+    for crop in crops:
+        y = g_a.run(None, {g_a.get_inputs()[0].name: crop})[0]
+        latents.append((np.round(y - medians) + medians).astype(np.float32))
+    quantize(prefix + "g_s.onnx", prefix + "g_s.int8.onnx", latents, args)
+
+
+if __name__ == "__main__":
+    main()